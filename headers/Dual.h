@@ -0,0 +1,62 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <cmath>
+#include <complex>
+
+// Дуальное число value + derivative * eps, eps^2 = 0: арифметика над ним
+// переносит производную вместе со значением (прямой режим дифференцирования).
+// T - double или std::complex<double>.
+template <typename T>
+struct Dual {
+    T value{};
+    T derivative{};
+
+    Dual() = default;
+    Dual(const T &value, const T &derivative = T(0)) : value(value), derivative(derivative) {} // константа
+
+    // Сравнение по значению: деление на число с нулевым значением - деление на ноль
+    bool operator==(const Dual &other) const { return value == other.value; }
+
+    Dual operator-() const { return {-value, -derivative}; }
+    friend Dual operator+(const Dual &a, const Dual &b) { return {a.value + b.value, a.derivative + b.derivative}; }
+    friend Dual operator-(const Dual &a, const Dual &b) { return {a.value - b.value, a.derivative - b.derivative}; }
+    friend Dual operator*(const Dual &a, const Dual &b) {
+        return {a.value * b.value, a.derivative * b.value + a.value * b.derivative};
+    }
+    friend Dual operator/(const Dual &a, const Dual &b) {
+        T value = a.value / b.value;
+        return {value, (a.derivative - value * b.derivative) / b.value};
+    }
+
+    // Функции находятся по ADL из apply_function/apply_operation
+    friend Dual sin(const Dual &a) {
+        using std::sin, std::cos;
+        return {sin(a.value), cos(a.value) * a.derivative};
+    }
+    friend Dual cos(const Dual &a) {
+        using std::sin, std::cos;
+        return {cos(a.value), -sin(a.value) * a.derivative};
+    }
+    friend Dual log(const Dual &a) {
+        using std::log;
+        return {log(a.value), a.derivative / a.value};
+    }
+    friend Dual exp(const Dual &a) {
+        using std::exp;
+        T value = exp(a.value);
+        return {value, value * a.derivative};
+    }
+    // a^b: b a^(b-1) a' + a^b ln(a) b'. Слагаемые с нулевой производной пропускаются,
+    // чтобы постоянная степень отрицательного основания (или степень нуля) не давала nan
+    friend Dual pow(const Dual &a, const Dual &b) {
+        using std::pow, std::log;
+        T value = pow(a.value, b.value);
+        T derivative = T(0);
+        if (a.derivative != T(0)) derivative += b.value * pow(a.value, b.value - T(1)) * a.derivative;
+        if (b.derivative != T(0)) derivative += value * log(a.value) * b.derivative;
+        return {value, derivative};
+    }
+};
+
+#endif // DUAL_H
@@ -1,12 +1,18 @@
 #ifndef EXPRESSION_H
 #define EXPRESSION_H
+#include "Symbols.h"
 #include <cmath>
 #include <complex>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <new>
 #include <string>
 #include <stdexcept>
+#include <unordered_map>
+#include <vector>
 
 enum Operation { PLUS, MINUS, MULT, DIV, POW };
 enum Function { SIN, COS, LN, EXP };
@@ -18,7 +24,8 @@ struct operators {
         switch (type) {
             case PLUS: case MINUS: priority = 1; break;
             case MULT: case DIV: priority = 2; break;
-            case POW: priority = 3;
+            case POW: priority = 3; break;
+            default: throw std::runtime_error("Unknown operation");
         }
     }
 };
@@ -31,33 +38,222 @@ inline std::string to_string_optimized(double a) {
     return std::to_string(a);
 }
 
+// Общая семантика операций и функций (дерево и компилированная программа считают одинаково)
+template <typename T>
+T apply_operation(Operation op, const T &left, const T &right) {
+    switch (op) {
+        case PLUS: return left + right;
+        case MINUS: return left - right;
+        case MULT: return left * right;
+        case DIV:
+            if (right == T(0)) throw std::runtime_error("Division by zero");
+            return left / right;
+        case POW: {
+            using std::pow; // для своих числовых типов (Dual.h) находится по ADL
+            return pow(left, right);
+        }
+        default: throw std::runtime_error("Unknown operation");
+    }
+}
+
+template <typename T>
+T apply_function(Function func, const T &arg) {
+    using std::sin, std::cos, std::log, std::exp;
+    switch (func) {
+        case SIN: return sin(arg);
+        case COS: return cos(arg);
+        case LN: return log(arg);
+        case EXP: return exp(arg);
+        default: throw std::runtime_error("Unknown function");
+    }
+}
+
+template <typename T>
+class Compiler; // Program.h
+template <typename T>
+class FlatExpression; // FlatExpression.h
+
+template <typename T>
+struct Expression;
+
+// Создание узлов через ExpressionFactory (ниже): одинаковые узлы не дублируются
+template <typename T>
+std::shared_ptr<Expression<T>> make_constant(const T &value);
+template <typename T>
+std::shared_ptr<Expression<T>> make_var(const std::string &name);
+template <typename T>
+std::shared_ptr<Expression<T>> make_mono(const std::shared_ptr<Expression<T>> &expr, Function func);
+template <typename T>
+std::shared_ptr<Expression<T>> make_binary(const std::shared_ptr<Expression<T>> &left,
+                                           const std::shared_ptr<Expression<T>> &right, Operation op);
+
+// Обход DAG без рекурсии: visit(node) вызывается после всех детей узла, но только для узлов,
+// на которых done(node) ложно; visit должен делать done(node) истинным. done вызывается
+// ровно один раз на каждое вхождение узла. Node - Expression<T> * или std::shared_ptr<Expression<T>>.
+template <typename Node, typename Done, typename Visit>
+void post_order(const Node &root, Done done, Visit visit) {
+    if (done(root)) return;
+    std::vector<std::pair<Node, size_t>> stack; // узел и номер следующего ребенка
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+        if (auto operand = stack.back().first->operand(stack.back().second)) {
+            ++stack.back().second;
+            Node child;
+            if constexpr (std::is_pointer_v<Node>) child = operand->get();
+            else child = *operand;
+            if (!done(child)) stack.emplace_back(std::move(child), 0);
+            continue;
+        }
+        visit(stack.back().first);
+        stack.pop_back();
+    }
+}
+
 template <typename T>
 struct Expression {
     virtual ~Expression() = default;
 
-    virtual std::string to_string() = 0;
-    virtual T eval(std::map<std::string, T> &parameters) = 0;
-    virtual std::shared_ptr<Expression<T>> diff(std::string &str) = 0;
+    // Все проходы ниже идут по явному стеку, поэтому глубина дерева ограничена только памятью
+    std::string to_string() {
+        std::string out;
+        std::vector<Piece> rest{{this, nullptr}};
+        while (!rest.empty()) {
+            Piece piece = rest.back();
+            rest.pop_back();
+            if (piece.node) piece.node->write(out, rest);
+            else out += piece.text;
+        }
+        return out;
+    }
+
+    // Обход в обратной польской записи: результаты детей лежат на стеке значений,
+    // узел снимает их и кладет свой. Общий узел считается при каждом вхождении, как и
+    // раньше; один раз его считает скомпилированная программа (Program.h).
+    T eval(std::map<std::string, T> &parameters) {
+        if (!arity) return evaluate(parameters, nullptr);
+        // Буферы переиспользуются между вызовами; вложенный вызов получит пустые
+        thread_local std::vector<std::pair<Expression<T> *, size_t>> frame_scratch; // узел и номер следующего ребенка
+        thread_local std::vector<T> value_scratch;
+        auto frames = std::move(frame_scratch);
+        auto values = std::move(value_scratch);
+        frames.clear();
+        values.clear();
+        frames.emplace_back(this, 0);
+        while (!frames.empty()) {
+            auto &[node, next] = frames.back();
+            if (auto operand = node->operand(next)) {
+                ++next;
+                Expression<T> *child = operand->get();
+                if (child->arity) frames.emplace_back(child, 0);
+                else values.push_back(child->evaluate(parameters, nullptr));
+                continue;
+            }
+            T result = node->evaluate(parameters, values.data() + values.size() - next);
+            values.erase(values.end() - next, values.end());
+            values.push_back(std::move(result));
+            frames.pop_back();
+        }
+        T result = std::move(values.back());
+        frame_scratch = std::move(frames);
+        value_scratch = std::move(values);
+        return result;
+    }
+
+    // (узел, переменная) -> производная узла по ней. Кэш может переиспользоваться между
+    // вызовами diff, в том числе по разным переменным. Запись держит свой узел, поэтому адрес
+    // ключа не может достаться другому узлу, пока жив кэш; корень вызова владельца не имеет
+    // и в кэше не остается.
+    struct DiffKey {
+        const Expression<T> *node;
+        Symbol var;
+        bool operator==(const DiffKey &other) const = default;
+    };
+    struct DiffKeyHash {
+        size_t operator()(const DiffKey &key) const {
+            return std::hash<const void *>()(key.node) * 31 + key.var;
+        }
+    };
+    struct DiffEntry {
+        std::shared_ptr<Expression<T>> node;
+        std::shared_ptr<Expression<T>> derivative;
+    };
+    using DiffCache = std::unordered_map<DiffKey, DiffEntry, DiffKeyHash>;
+
+    // Производная по str: общий узел дифференцируется один раз за вызов,
+    // поэтому размер результата полиномиален от числа различных узлов
+    std::shared_ptr<Expression<T>> diff(std::string &str) {
+        DiffCache cache;
+        return diff(find_symbol(str), cache);
+    }
+    std::shared_ptr<Expression<T>> diff(std::string &str, DiffCache &cache) {
+        return diff(find_symbol(str), cache); // имени нет в таблице - производная везде 0
+    }
+    std::shared_ptr<Expression<T>> diff(Symbol var, DiffCache &cache) {
+        if (auto it = cache.find({this, var}); it != cache.end()) return it->second.derivative;
+        std::shared_ptr<Expression<T>> root(std::shared_ptr<void>(), this); // без владения
+        post_order(root, [&](const std::shared_ptr<Expression<T>> &node) { return cache.count({node.get(), var}) > 0; },
+                   [&](const std::shared_ptr<Expression<T>> &node) {
+                       std::shared_ptr<Expression<T>> diffs[2];
+                       for (size_t i = 0; auto child = node->operand(i); ++i) {
+                           diffs[i] = cache.at({child->get(), var}).derivative;
+                       }
+                       auto derivative = node->derive(var, diffs);
+                       cache.emplace(DiffKey{node.get(), var}, DiffEntry{node == root ? nullptr : node, derivative});
+                   });
+        auto result = std::move(cache.at({this, var}).derivative);
+        cache.erase({this, var});
+        return result;
+    }
+
+    // i-й ребенок узла; nullptr, если его нет. Без виртуального вызова: узлов с детьми два вида
+    const std::shared_ptr<Expression<T>> *operand(size_t i) const; // реализация ниже
+
+protected:
+    unsigned char arity = 0; // число детей: 1 у MonoExpression, 2 у BinaryExpression
+
+    // Часть записи: узел или готовый текст
+    struct Piece {
+        Expression<T> *node;
+        const char *text;
+    };
+
+    // Шаги проходов для одного узла, дети уже обработаны (или отложены)
+    virtual T evaluate(std::map<std::string, T> &parameters, const T *args) = 0;
+    virtual std::shared_ptr<Expression<T>> derive(Symbol var, const std::shared_ptr<Expression<T>> *diffs) = 0;
+    // Дописывает начало записи узла в out, остальное кладет в rest в обратном порядке
+    virtual void write(std::string &out, std::vector<Piece> &rest) = 0;
 };
 
+// Освобождение детей без рекурсии деструкторов: последние ссылки складываются в список
+// самого внешнего из вложенных вызовов, он их и разбирает. Указатель на список тривиально
+// разрушаем, так что выражения в статических объектах можно уничтожать и при выходе из программы.
+template <typename T>
+void release_operand(std::shared_ptr<Expression<T>> &child) {
+    thread_local std::vector<std::shared_ptr<Expression<T>>> *pending = nullptr;
+    if (child.use_count() != 1) { // узел еще нужен кому-то или живет в арене
+        child.reset();
+        return;
+    }
+    if (pending) {
+        pending->push_back(std::move(child));
+        return;
+    }
+    std::vector<std::shared_ptr<Expression<T>>> nodes;
+    nodes.push_back(std::move(child));
+    pending = &nodes;
+    while (!nodes.empty()) {
+        auto node = std::move(nodes.back());
+        nodes.pop_back();
+        // node уничтожается здесь, его дети попадают в nodes
+    }
+    pending = nullptr;
+}
+
 template <typename T>
 class ConstantExpression : public Expression<T> {
     T value;
-public:
-    explicit ConstantExpression(T value) : value(value) {}
-    ~ConstantExpression() override = default;
-    ConstantExpression(const ConstantExpression<T> &other) = default;
-    ConstantExpression(ConstantExpression<T> &&other) = default;
-    ConstantExpression &operator=(const ConstantExpression<T> &other) = default;
-    ConstantExpression &operator=(ConstantExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        return value;
-    }
-    std::shared_ptr<Expression<T>> diff(std::string &str) override {
-        return std::make_shared<ConstantExpression<T>>(T(0));
-    }
-    std::string to_string() override {
+    std::string text() const {
         if constexpr (std::is_same_v<T, std::complex<double>>) {
             // Специальная обработка для комплексных чисел
             double real = value.real();
@@ -76,29 +272,53 @@ public:
             return to_string_optimized(value);
         }
     }
+
+public:
+    explicit ConstantExpression(T value) : value(value) {}
+    ~ConstantExpression() override = default;
+    ConstantExpression(const ConstantExpression<T> &other) = default;
+    ConstantExpression(ConstantExpression<T> &&other) = default;
+    ConstantExpression &operator=(const ConstantExpression<T> &other) = default;
+    ConstantExpression &operator=(ConstantExpression<T> &&other) = default;
+
+    T evaluate(std::map<std::string, T> &parameters, const T *args) override {
+        return value;
+    }
+    std::shared_ptr<Expression<T>> derive(Symbol var, const std::shared_ptr<Expression<T>> *diffs) override {
+        return make_constant(T(0));
+    }
+    void write(std::string &out, std::vector<typename Expression<T>::Piece> &rest) override {
+        out += text();
+    }
+    friend class Compiler<T>;
+    friend class FlatExpression<T>;
 };
 
 template <typename T>
 class VarExpression : public Expression<T> {
-    std::string value;
+    Symbol symbol; // номер имени в таблице Symbols.h
+    const std::string *name; // имя из той же таблицы: строка не перемещается, вычисление идет без блокировки
 public:
-    explicit VarExpression(const std::string &value) : value(value) {}
+    explicit VarExpression(const std::string &value) : VarExpression(intern_symbol(value)) {}
+    explicit VarExpression(Symbol symbol) : symbol(symbol), name(&symbol_name(symbol)) {}
     ~VarExpression() override = default;
     VarExpression(const VarExpression<T> &other) = default;
     VarExpression(VarExpression<T> &&other) = default;
     VarExpression &operator=(const VarExpression<T> &other) = default;
     VarExpression &operator=(VarExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        return parameters[value];
+    T evaluate(std::map<std::string, T> &parameters, const T *args) override {
+        return parameters[*name];
     }
-    std::shared_ptr<Expression<T>> diff(std::string &str) override {
-        if (str == value) return std::make_shared<ConstantExpression<T>>(T(1));
-        return std::make_shared<ConstantExpression<T>>(T(0));
+    std::shared_ptr<Expression<T>> derive(Symbol var, const std::shared_ptr<Expression<T>> *diffs) override {
+        if (var == symbol) return make_constant(T(1));
+        return make_constant(T(0));
     }
-    std::string to_string() override {
-        return value;
+    void write(std::string &out, std::vector<typename Expression<T>::Piece> &rest) override {
+        out += *name;
     }
+    friend class Compiler<T>;
+    friend class FlatExpression<T>;
 };
 
 template <typename T>
@@ -107,26 +327,24 @@ class MonoExpression: public Expression<T> {
     Function func;
 public:
     MonoExpression(const std::shared_ptr<Expression<T>> &expr, Function func)
-        : expr(expr), func(func) {}
-    ~MonoExpression() override = default;
+        : expr(expr), func(func) {
+        this->arity = 1;
+    }
+    ~MonoExpression() override { release_operand(expr); }
     MonoExpression(const MonoExpression<T> &other) = default;
     MonoExpression(MonoExpression<T> &&other) = default;
     MonoExpression &operator=(const MonoExpression<T> &other) = default;
     MonoExpression &operator=(MonoExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        switch (func) {
-            case SIN: return std::sin(expr->eval(parameters));
-            case COS: return std::cos(expr->eval(parameters));
-            case LN: return std::log(expr->eval(parameters));
-            case EXP: return std::exp(expr->eval(parameters));
-            default: throw std::runtime_error("Unknown function");
-        }
+    T evaluate(std::map<std::string, T> &parameters, const T *args) override {
+        return apply_function(func, args[0]);
     }
-    std::shared_ptr<Expression<T>> diff(std::string &str) override; // реализация ниже
-    std::string to_string() override ;
+    std::shared_ptr<Expression<T>> derive(Symbol var, const std::shared_ptr<Expression<T>> *diffs) override; // реализация ниже
+    void write(std::string &out, std::vector<typename Expression<T>::Piece> &rest) override;
     friend std::shared_ptr<Expression<T>> optimize<T> (std::shared_ptr<Expression<T>> expr);
-
+    friend class Compiler<T>;
+    friend class FlatExpression<T>;
+    friend struct Expression<T>;
 };
 
 template <typename T>
@@ -139,50 +357,44 @@ public:
                      const std::shared_ptr<Expression<T>> &right,
                      Operation op)
         : left(left), right(right), op(op) {
+        this->arity = 2;
         /*if (auto right_ptr = dynamic_pointer_cast<ConstantExpression<T>>(T(0))) {
             throw std::runtime_error("Division by zero");
         }*/
     }
-    ~BinaryExpression() override = default;
+    ~BinaryExpression() override {
+        release_operand(left);
+        release_operand(right);
+    }
     BinaryExpression(const BinaryExpression<T> &other) = default;
     BinaryExpression(BinaryExpression<T> &&other) = default;
     BinaryExpression &operator=(const BinaryExpression<T> &other) = default;
     BinaryExpression &operator=(BinaryExpression<T> &&other) = default;
 
-    T eval(std::map<std::string, T> &parameters) override {
-        switch (op) {
-            case PLUS: return left->eval(parameters) + right->eval(parameters);
-            case MINUS: return left->eval(parameters) - right->eval(parameters);
-            case MULT: return left->eval(parameters) * right->eval(parameters);
-            case DIV:
-                if (right->eval(parameters) == T(0)) throw std::runtime_error("Division by zero");
-                return left->eval(parameters) / right->eval(parameters);
-            case POW: return std::pow(left->eval(parameters), right->eval(parameters));
-            default: throw std::runtime_error("Unknown operation");
-
-        }
+    T evaluate(std::map<std::string, T> &parameters, const T *args) override {
+        return apply_operation(op, args[0], args[1]);
     }
-    std::shared_ptr<Expression<T>> diff(std::string &str) override {
-        auto left_diff = left->diff(str);
-        auto right_diff = right->diff(str);
+    std::shared_ptr<Expression<T>> derive(Symbol var, const std::shared_ptr<Expression<T>> *diffs) override {
+        const auto &left_diff = diffs[0];
+        const auto &right_diff = diffs[1];
         switch (op) {
             case PLUS:
-                return std::make_shared<BinaryExpression<T>>(left_diff, right_diff, PLUS);
+                return make_binary(left_diff, right_diff, PLUS);
             case MINUS:
-                return std::make_shared<BinaryExpression<T>>(left_diff, right_diff, MINUS);
+                return make_binary(left_diff, right_diff, MINUS);
             case MULT: {
-                auto left_mult = std::make_shared<BinaryExpression<T>>(left_diff, right, MULT);
-                auto right_mult = std::make_shared<BinaryExpression<T>>(left, right_diff, MULT);
-                return std::make_shared<BinaryExpression<T>>(left_mult, right_mult, PLUS);
+                auto left_mult = make_binary(left_diff, right, MULT);
+                auto right_mult = make_binary(left, right_diff, MULT);
+                return make_binary(left_mult, right_mult, PLUS);
             }
             case DIV: {
-                auto numerator = std::make_shared<BinaryExpression<T>>(
-                    std::make_shared<BinaryExpression<T>>(left_diff, right, MULT),
-                    std::make_shared<BinaryExpression<T>>(left, right_diff, MULT),
+                auto numerator = make_binary(
+                    make_binary(left_diff, right, MULT),
+                    make_binary(left, right_diff, MULT),
                     MINUS);
-                auto denominator = std::make_shared<BinaryExpression<T>>(
-                    right, std::make_shared<ConstantExpression<T>>(T(2)), POW);
-                return std::make_shared<BinaryExpression<T>>(numerator, denominator, DIV);
+                auto denominator = make_binary(
+                    right, make_constant(T(2)), POW);
+                return make_binary(numerator, denominator, DIV);
             }
             case POW: {
 
@@ -191,197 +403,429 @@ public:
                     // f(x) ^ const
                     if (auto right_const = std::dynamic_pointer_cast<ConstantExpression<T>>(right)) {
                         if (right_const->eval(map) > T(1)) {
-                            auto power = std::make_shared<ConstantExpression<T>>(right_const->eval(map) - T(1));
-                            auto multiplier = std::make_shared<BinaryExpression<T>>(left, power, POW);
-                            return std::make_shared<BinaryExpression<T>>(
+                            auto power = make_constant(right_const->eval(map) - T(1));
+                            auto multiplier = make_binary(left, power, POW);
+                            return make_binary(
                                 right,
-                                std::make_shared<BinaryExpression<T>>(
+                                make_binary(
                                     multiplier , left_diff, MULT),
                                 MULT);
                         }
                         if (right_const->eval(map) == 1)
-                            return std::make_shared<ConstantExpression<T>>(T(1));
+                            return make_constant(T(1));
 
-                        auto multiplier = std::make_shared<BinaryExpression<T>>(right, left_diff, MULT);
-                        auto power = std::make_shared<ConstantExpression<T>>(T(std::abs(right_const->eval(map)) + T(1)));
-                        return std::make_shared<BinaryExpression<T>>(multiplier,
-                            std::make_shared<BinaryExpression<T>>(left, power, POW), DIV);
+                        auto multiplier = make_binary(right, left_diff, MULT);
+                        auto power = make_constant(T(std::abs(right_const->eval(map)) + T(1)));
+                        return make_binary(multiplier,
+                            make_binary(left, power, POW), DIV);
                     }
                     // const ^ f(x)
                     if (auto left_const = std::dynamic_pointer_cast<ConstantExpression<T>>(left)) {
-                        auto multiplier1 = std::make_shared<BinaryExpression<T>>(left, right, POW);
-                        auto multiplier2 = std::make_shared<MonoExpression<T>>(left, LN);
-                        return std::make_shared<BinaryExpression<T>>(
+                        auto multiplier1 = make_binary(left, right, POW);
+                        auto multiplier2 = make_mono(left, LN);
+                        return make_binary(
                             right_diff,
-                            std::make_shared<BinaryExpression<T>>(
+                            make_binary(
                                 multiplier1,
                                 multiplier2, MULT),
                             MULT);
                     }
 
                     // f(x) ^ g(x)
-                    auto term1 = std::make_shared<BinaryExpression<T>>(
-                        right_diff, std::make_shared<MonoExpression<T>>(left, LN), MULT);
-                    auto term2 = std::make_shared<BinaryExpression<T>>(
-                        right, std::make_shared<BinaryExpression<T>>(left_diff, left, DIV), MULT);
-                    return std::make_shared<BinaryExpression<T>>(term1, term2, PLUS);
+                    auto term1 = make_binary(
+                        right_diff, make_mono(left, LN), MULT);
+                    auto term2 = make_binary(
+                        right, make_binary(left_diff, left, DIV), MULT);
+                    return make_binary(term1, term2, PLUS);
                 }
 
             }
             default: throw std::runtime_error("Unknown operation");
         }
     }
-    std::string to_string() override {
+    void write(std::string &out, std::vector<typename Expression<T>::Piece> &rest) override {
+        const char *sign;
         switch (op) {
-            case PLUS: return "(" + left->to_string() + " + " + right->to_string() + ")";
-            case MINUS: return "(" + left->to_string() + " - " + right->to_string() + ")";
-            case MULT: return "(" + left->to_string() + " * " + right->to_string() + ")";
-            case DIV: return "(" + left->to_string() + " / " + right->to_string() + ")";
-            case POW: return "(" + left->to_string() + "^" + right->to_string() + ")";
-            default: return "Unknown operation";
+            case PLUS: sign = " + "; break;
+            case MINUS: sign = " - "; break;
+            case MULT: sign = " * "; break;
+            case DIV: sign = " / "; break;
+            case POW: sign = "^"; break;
+            default: out += "Unknown operation"; return;
         }
+        out += "(";
+        rest.push_back({nullptr, ")"});
+        rest.push_back({right.get(), nullptr});
+        rest.push_back({nullptr, sign});
+        rest.push_back({left.get(), nullptr});
     }
     friend std::shared_ptr<Expression<T>> optimize<T> (std::shared_ptr<Expression<T>> expr);
+    friend class Compiler<T>;
+    friend class FlatExpression<T>;
+    friend struct Expression<T>;
 };
+
+template <typename T>
+const std::shared_ptr<Expression<T>> *Expression<T>::operand(size_t i) const {
+    if (i >= arity) return nullptr;
+    if (arity == 1) return &static_cast<const MonoExpression<T> *>(this)->expr;
+    auto binary = static_cast<const BinaryExpression<T> *>(this);
+    return i == 0 ? &binary->left : &binary->right;
+}
+
 template<typename T>
-std::string MonoExpression<T>::to_string() {
-    if (auto binary = std::dynamic_pointer_cast<BinaryExpression<T>>(expr)) {
-        switch (func) {
-            case SIN: return "sin" + expr->to_string();
-            case COS: return "cos" + expr->to_string();
-            case LN: return "ln" + expr->to_string();
-            case EXP: return "exp" + expr->to_string();
-            default: return "Unknown function";
-        }
-    }
+void MonoExpression<T>::write(std::string &out, std::vector<typename Expression<T>::Piece> &rest) {
     switch (func) {
-        case SIN: return "sin(" + expr->to_string() + ")";
-        case COS: return "cos(" + expr->to_string() + ")";
-        case LN: return "ln(" + expr->to_string() + ")";
-        case EXP: return "exp(" + expr->to_string() + ")";
-        default: return "Unknown function";
+        case SIN: out += "sin"; break;
+        case COS: out += "cos"; break;
+        case LN: out += "ln"; break;
+        case EXP: out += "exp"; break;
+        default: out += "Unknown function"; return;
+    }
+    if (std::dynamic_pointer_cast<BinaryExpression<T>>(expr)) { // у бинарного свои скобки
+        rest.push_back({expr.get(), nullptr});
+        return;
     }
+    out += "(";
+    rest.push_back({nullptr, ")"});
+    rest.push_back({expr.get(), nullptr});
 }
 
 template<typename T>
-std::shared_ptr<Expression<T> > MonoExpression<T>::diff(std::string &str) {
-    auto expr_diff = expr->diff(str);
+std::shared_ptr<Expression<T> > MonoExpression<T>::derive(Symbol var, const std::shared_ptr<Expression<T>> *diffs) {
+    const auto &expr_diff = diffs[0];
     switch (func) {
         case SIN:
-            return std::make_shared<BinaryExpression<T>>(
-                std::make_shared<MonoExpression<T>>(expr, COS),
+            return make_binary(
+                make_mono(expr, COS),
                 expr_diff, MULT);
         case COS:
-            return std::make_shared<BinaryExpression<T>>(
-                std::make_shared<BinaryExpression<T>>(
-                    std::make_shared<ConstantExpression<T>>(T(-1)),
-                    std::make_shared<MonoExpression<T>>(expr, SIN),
+            return make_binary(
+                make_binary(
+                    make_constant(T(-1)),
+                    make_mono(expr, SIN),
                     MULT),
                 expr_diff, MULT);
         case LN:
-            return std::make_shared<BinaryExpression<T>>(expr_diff, expr, DIV);
+            return make_binary(expr_diff, expr, DIV);
         case EXP:
-            return std::make_shared<BinaryExpression<T>>(
-                std::make_shared<MonoExpression<T>>(expr, EXP),
+            return make_binary(
+                make_mono(expr, EXP),
                 expr_diff, MULT);
         default: throw std::runtime_error("Unknown function");
     }
 }
 
+template <typename T>
+class ExpressionArena;
+
+// Ключ узла в таблицах хеш-консинга
+struct NodeKey {
+    const void *left;
+    const void *right;
+    int kind; // 0 - MonoExpression, 1 - BinaryExpression
+    int op;
+    bool operator==(const NodeKey &other) const = default;
+};
+
+struct NodeKeyHash {
+    size_t operator()(const NodeKey &key) const {
+        size_t h = std::hash<const void *>()(key.left);
+        h = h * 31 + std::hash<const void *>()(key.right);
+        return h * 31 + static_cast<size_t>(key.kind * 8 + key.op);
+    }
+};
+
+// Таблицы хеш-консинга: Handle - weak_ptr для узлов в куче, shared_ptr для узлов арены
+template <typename T, typename Handle>
+struct InternTables {
+    std::unordered_map<std::string, Handle> constants; // по байтам значения
+    std::unordered_map<Symbol, Handle> variables;
+    std::unordered_map<NodeKey, Handle, NodeKeyHash> nodes;
+
+    size_t size() const {
+        return constants.size() + variables.size() + nodes.size();
+    }
+};
+
+// Хеш-консинг: узел с теми же (операция, дети) или той же константой/переменной
+// возвращается уже существующий, поэтому выражения и производные хранятся как DAG
+// с максимальным разделением. Дети уже уникальны, так что сравниваются их адреса.
+// Таблица держит только weak_ptr и своя у каждого потока. Узлы после создания не изменяются.
+// Пока действует ExpressionArena<T>::Scope, узлы создаются в арене.
+template <typename T>
+class ExpressionFactory {
+    using Owned = InternTables<T, std::weak_ptr<Expression<T>>>;
+
+    Owned owned;
+    ExpressionArena<T> *arena = nullptr;
+    size_t limit = 1024; // после стольких записей убираем умершие
+
+    template <typename Map, typename K, typename Make>
+    std::shared_ptr<Expression<T>> intern(Map &map, const K &key, Make make) {
+        auto &slot = map[key];
+        if constexpr (std::is_same_v<typename Map::mapped_type, std::weak_ptr<Expression<T>>>) {
+            if (auto existing = slot.lock()) return existing;
+            std::shared_ptr<Expression<T>> created = make();
+            slot = created;
+            if (size() > limit) {
+                purge();
+                limit = std::max<size_t>(1024, 2 * size());
+            }
+            return created;
+        } else {
+            if (!slot) slot = make(); // узлы арены живут до ее уничтожения
+            return slot;
+        }
+    }
+
+    // f(таблицы, создание узла) для текущего места хранения
+    template <typename F>
+    std::shared_ptr<Expression<T>> with_storage(F f) {
+        if (arena) {
+            return f(arena->tables, [this](auto tag, auto &&...args) {
+                return arena->template make<typename decltype(tag)::type>(args...);
+            });
+        }
+        return f(owned, [](auto tag, auto &&...args) -> std::shared_ptr<Expression<T>> {
+            return std::make_shared<typename decltype(tag)::type>(args...);
+        });
+    }
+
+    template <typename Node>
+    struct Tag { using type = Node; };
+
+    friend class ExpressionArena<T>;
+
+public:
+    static ExpressionFactory &current() {
+        thread_local ExpressionFactory factory;
+        return factory;
+    }
+
+    std::shared_ptr<Expression<T>> constant(const T &value) {
+        std::string bytes(sizeof(T), '\0');
+        std::memcpy(bytes.data(), &value, sizeof(T));
+        return with_storage([&](auto &tables, auto create) {
+            return intern(tables.constants, bytes, [&] { return create(Tag<ConstantExpression<T>>(), value); });
+        });
+    }
+    std::shared_ptr<Expression<T>> var(Symbol symbol) {
+        return with_storage([&](auto &tables, auto create) {
+            return intern(tables.variables, symbol, [&] { return create(Tag<VarExpression<T>>(), symbol); });
+        });
+    }
+    std::shared_ptr<Expression<T>> mono(const std::shared_ptr<Expression<T>> &expr, Function func) {
+        return with_storage([&](auto &tables, auto create) {
+            return intern(tables.nodes, NodeKey{expr.get(), nullptr, 0, func},
+                          [&] { return create(Tag<MonoExpression<T>>(), expr, func); });
+        });
+    }
+    std::shared_ptr<Expression<T>> binary(const std::shared_ptr<Expression<T>> &left,
+                                          const std::shared_ptr<Expression<T>> &right, Operation op) {
+        return with_storage([&](auto &tables, auto create) {
+            return intern(tables.nodes, NodeKey{left.get(), right.get(), 1, op},
+                          [&] { return create(Tag<BinaryExpression<T>>(), left, right, op); });
+        });
+    }
+
+    // Узлы текущего потока создаются в куче до конца области видимости, даже внутри
+    // ExpressionArena<T>::Scope: для результатов, которые должны пережить арену
+    class HeapScope {
+        ExpressionArena<T> *previous;
+    public:
+        HeapScope() : previous(current().arena) { current().arena = nullptr; }
+        ~HeapScope() { current().arena = previous; }
+        HeapScope(const HeapScope &) = delete;
+        HeapScope &operator=(const HeapScope &) = delete;
+    };
+
+    // Записи для узлов в куче (арена считает свои сама)
+    size_t size() const {
+        return owned.size();
+    }
+    void purge() {
+        std::erase_if(owned.constants, [](const auto &entry) { return entry.second.expired(); });
+        std::erase_if(owned.variables, [](const auto &entry) { return entry.second.expired(); });
+        std::erase_if(owned.nodes, [](const auto &entry) { return entry.second.expired(); });
+    }
+};
+
+// Арена узлов на один сеанс разбора/дифференцирования/упрощения: узлы размещаются
+// подряд в больших блоках, выдаются как shared_ptr без блока управления (счетчик
+// ссылок не трогается) и уничтожаются все сразу вместе с ареной.
+// Узлы арены нельзя использовать после ее уничтожения; Program их не хранит,
+// так что скомпилированную программу можно оставить.
+//
+//     ExpressionArena<double> arena;
+//     ExpressionArena<double>::Scope scope(arena); // make_* в этом потоке идут в арену
+//     auto program = compile(optimize(Parser<double>(tokens).parse()->diff(x)));
+template <typename T>
+class ExpressionArena {
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    size_t used = BLOCK_SIZE; // занято в последнем блоке
+    std::vector<Expression<T> *> nodes; // для деструкторов
+    InternTables<T, std::shared_ptr<Expression<T>>> tables;
+
+    void *allocate(size_t size, size_t align) {
+        used = (used + align - 1) / align * align;
+        if (used + size > BLOCK_SIZE) {
+            blocks.push_back(std::make_unique<std::byte[]>(BLOCK_SIZE));
+            used = 0;
+        }
+        void *memory = blocks.back().get() + used;
+        used += size;
+        return memory;
+    }
+
+    template <typename Node, typename... Args>
+    std::shared_ptr<Expression<T>> make(const Args &...args) {
+        static_assert(sizeof(Node) <= BLOCK_SIZE && alignof(Node) <= alignof(std::max_align_t));
+        Node *node = new (allocate(sizeof(Node), alignof(Node))) Node(args...);
+        nodes.push_back(node);
+        return std::shared_ptr<Expression<T>>(std::shared_ptr<void>(), node); // без владения
+    }
+
+    friend class ExpressionFactory<T>;
+
+public:
+    ExpressionArena() = default;
+    ExpressionArena(const ExpressionArena &) = delete;
+    ExpressionArena &operator=(const ExpressionArena &) = delete;
+    ~ExpressionArena() {
+        tables = {};
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) (*it)->~Expression();
+    }
+
+    size_t size() const { return nodes.size(); }
+
+    // Направляет создание узлов текущего потока в арену до конца области видимости
+    class Scope {
+        ExpressionArena *previous;
+    public:
+        explicit Scope(ExpressionArena &arena) : previous(ExpressionFactory<T>::current().arena) {
+            ExpressionFactory<T>::current().arena = &arena;
+        }
+        ~Scope() { ExpressionFactory<T>::current().arena = previous; }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+};
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_constant(const T &value) {
+    return ExpressionFactory<T>::current().constant(value);
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_var(const std::string &name) {
+    return ExpressionFactory<T>::current().var(intern_symbol(name));
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_mono(const std::shared_ptr<Expression<T>> &expr, Function func) {
+    return ExpressionFactory<T>::current().mono(expr, func);
+}
+
+template <typename T>
+std::shared_ptr<Expression<T>> make_binary(const std::shared_ptr<Expression<T>> &left,
+                                           const std::shared_ptr<Expression<T>> &right, Operation op) {
+    return ExpressionFactory<T>::current().binary(left, right, op);
+}
+
+// Упрощение не изменяет узлы (они могут быть общими), а строит новые.
+// Узлы обходятся по явному стеку, общий узел упрощается один раз.
 template <typename T>
 std::shared_ptr<Expression<T>> optimize (std::shared_ptr<Expression<T>> expr) {
-    if (auto mono = std::dynamic_pointer_cast<MonoExpression<T>>(expr)) {
-        mono->expr = optimize(mono->expr);
-    }
-    if (auto binary = std::dynamic_pointer_cast<BinaryExpression<T>>(expr)) {
-        binary->left = optimize(binary->left);
-        binary->right = optimize(binary->right);
-        /*if (auto left_b = std::dynamic_pointer_cast<BinaryExpression<T>>(binary->left)) {
-            optimize(std::dynamic_pointer_cast<Expression<T>>(left_b));
+    std::unordered_map<const Expression<T> *, std::shared_ptr<Expression<T>>> done; // узел -> упрощенный
+    // Шаг для узла, дети которого уже упрощены
+    auto step = [&done](std::shared_ptr<Expression<T>> expr) -> std::shared_ptr<Expression<T>> {
+        if (auto mono = std::dynamic_pointer_cast<MonoExpression<T>>(expr)) {
+            auto arg = done.at(mono->expr.get());
+            return arg == mono->expr ? expr : make_mono(arg, mono->func);
         }
-        if (auto right_b = std::dynamic_pointer_cast<BinaryExpression<T>>(binary->right)) {
-            optimize(std::dynamic_pointer_cast<Expression<T>>(right_b));
-        }*/
-        auto left = std::dynamic_pointer_cast<ConstantExpression<T>>(binary->left);
-        auto right = std::dynamic_pointer_cast<ConstantExpression<T>>(binary->right);
+        auto binary = std::dynamic_pointer_cast<BinaryExpression<T>>(expr);
+        if (!binary) return expr;
+
+        auto left_expr = done.at(binary->left.get());
+        auto right_expr = done.at(binary->right.get());
+        if (left_expr != binary->left || right_expr != binary->right) {
+            expr = make_binary(left_expr, right_expr, binary->op);
+        }
+        auto left = std::dynamic_pointer_cast<ConstantExpression<T>>(left_expr);
+        auto right = std::dynamic_pointer_cast<ConstantExpression<T>>(right_expr);
+        std::map <std::string, T> map;
         // Если сложение или вычитание нас интересуют нули
         if (binary->op == PLUS || binary->op == MINUS) {
             // Оба константы
             if (left && right) {
-                std::map <std::string, T> map;
                 // Есть ноль
                 if (left->eval(map) == T(0) || right->eval(map) == T(0)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(expr->eval(map)));
+                    return make_constant(expr->eval(map));
                 }
             // Если только левое выражение - константа
             } else if (left) {
-                std::map <std::string, T> map;
                 // Если оно ноль
                 if (left->eval(map) == T(0)) {
-                    if (binary->op == MINUS) {
-                        binary->op = MULT;
-                        binary->left = std::make_shared<ConstantExpression<T>>(T(-1));
-                    } else {
-                        expr = binary->right;
-                    }
+                    if (binary->op == MINUS) return make_binary(make_constant(T(-1)), right_expr, MULT);
+                    return right_expr;
                 }
             // Если только правое выражение - константа
             } else if (right) {
-                std::map <std::string, T> map;
                 // Если оно ноль
-                if (right->eval(map) == T(0)) {
-                    expr = binary->left;
-                }
+                if (right->eval(map) == T(0)) return left_expr;
             }
         }
         if (binary->op == MULT || binary->op == DIV) {
             // Оба константы
             if (left && right) {
-                std::map <std::string, T> map;
                 // Есть ноль
                 if (left->eval(map) == T(0) || right->eval(map) == T(0)) {
                     if (binary->op == MULT) {
-                        expr = std::make_shared<ConstantExpression<T>>(T(0));
+                        expr = make_constant(T(0));
                     } else if (binary->op == DIV) {
                         if (right->eval(map) == T(0)) {
                             throw std::runtime_error("Division by zero");
                         } else if (left->eval(map) == T(0)) {
-                            expr = std::make_shared<ConstantExpression<T>>(T(0));
+                            expr = make_constant(T(0));
                         }
                     }
                 }
                 // Есть единица
                 if (left->eval(map) == T(1) || right->eval(map) == T(1)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(expr->eval(map)));
+                    expr = make_constant(expr->eval(map));
                 }
             // Если только левое выражение - константа
             } else if (left) {
-                std::map <std::string, T> map;
                 // Если оно единица
                 if (left->eval(map) == T(1)) {
                     if (binary->op == MULT) {
-                        expr = binary->right;
+                        expr = right_expr;
                     }
                 }
                 // Если - 0
                 if (left->eval(map) == T(0)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(0));
+                    expr = make_constant(T(0));
                 }
-                // Если только правое выражение - константа
+            // Если только правое выражение - константа
             } else if (right) {
-                std::map <std::string, T> map;
                 // Если оно единица
                 if (right->eval(map) == T(1)) {
-                    expr = binary->left;
+                    expr = left_expr;
                 }
                 // Если - 0
                 if (right->eval(map) == T(0)) {
-                    expr = std::make_shared<ConstantExpression<T>>(T(0));
+                    expr = make_constant(T(0));
                 }
             }
-        } //
-    }
-    return expr;
+        }
+        return expr;
+    };
+    post_order(expr, [&](const std::shared_ptr<Expression<T>> &node) { return done.count(node.get()) > 0; },
+               [&](const std::shared_ptr<Expression<T>> &node) { done.emplace(node.get(), step(node)); });
+    return done.at(expr.get());
 }
 
 #endif //EXPRESSION_H
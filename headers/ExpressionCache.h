@@ -0,0 +1,127 @@
+#ifndef EXPRESSIONCACHE_H
+#define EXPRESSIONCACHE_H
+
+#include "Parser.h"
+#include "Program.h"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Результат разбора строки: упрощенное выражение, упрощенные производные
+// по запрошенным переменным и программа, считающая их все сразу
+template <typename T>
+struct CompiledExpression {
+    std::shared_ptr<Expression<T>> expr;
+    std::vector<std::string> variables; // имена в нижнем регистре, как у переменных выражения
+    std::vector<std::shared_ptr<Expression<T>>> derivatives; // derivatives[i] - по variables[i]
+    Program<T> program; // выходы: expr, затем производные в том же порядке
+};
+
+// Кэш разбора и компиляции с вытеснением давно не использованных записей (LRU).
+// Ключ - текст после нормализации (токены с их типами без пробелов, имена в нижнем регистре)
+// и список переменных, так что "Sin(X)+1" и "sin(x) + 1" - одна запись.
+// get можно вызывать из разных потоков; разбор при промахе идет без блокировки,
+// поэтому одна строка при одновременных промахах может разобраться дважды.
+// Записи неизменяемы и остаются действительными после вытеснения.
+// Узлы записей всегда создаются в куче, даже если get вызван внутри ExpressionArena<T>::Scope.
+template <typename T>
+class ExpressionCache {
+    using Entry = std::shared_ptr<const CompiledExpression<T>>;
+    using Order = std::list<std::pair<std::string, Entry>>; // от недавних к давним
+
+    size_t limit;
+    mutable std::mutex mutex;
+    Order order;
+    std::unordered_map<std::string, typename Order::iterator> index;
+    std::atomic<size_t> hit_count{0};
+    std::atomic<size_t> miss_count{0};
+
+    static Entry build(const std::vector<Token> &tokens, const std::vector<std::string> &variables) {
+        typename ExpressionFactory<T>::HeapScope heap; // записи переживают арену вызывающего
+        auto result = std::make_shared<CompiledExpression<T>>();
+        result->expr = optimize(Parser<T>(tokens).parse());
+        std::vector<std::shared_ptr<Expression<T>>> system{result->expr};
+        for (const auto &var : variables) {
+            result->variables.push_back(to_lower(var));
+            typename Expression<T>::DiffCache cache;
+            auto derivative = optimize(result->expr->diff(result->variables.back(), cache));
+            result->derivatives.push_back(derivative);
+            system.push_back(derivative);
+        }
+        result->program = compile(system);
+        return result;
+    }
+
+    static std::string key(const std::vector<Token> &tokens, const std::vector<std::string> &variables) {
+        std::string result;
+        for (const auto &token : tokens) {
+            if (!result.empty()) result += ' ';
+            // Тип токена - часть ключа: у "2i" и "2", у "i" и "1" одинаковый текст
+            result += static_cast<char>('0' + token.type);
+            if (token.type == VARIABLE || token.type == FUNCTION) result += to_lower(token.value);
+            else result += token.value;
+        }
+        result += '\n'; // в тексте выражения перевода строки уже нет
+        for (const auto &var : variables) result += to_lower(var) + ' ';
+        return result;
+    }
+
+public:
+    explicit ExpressionCache(size_t capacity = 1024) : limit(capacity) {
+        if (capacity == 0) throw std::runtime_error("Cache capacity must be positive");
+    }
+    ExpressionCache(const ExpressionCache &) = delete;
+    ExpressionCache &operator=(const ExpressionCache &) = delete;
+
+    // Разобранная, упрощенная и скомпилированная text с производными по variables.
+    // Ошибки разбора пробрасываются и не кэшируются.
+    Entry get(std::string_view text, const std::vector<std::string> &variables = {}) {
+        auto tokens = tokenize(text);
+        std::string name = key(tokens, variables);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(name);
+            if (it != index.end()) {
+                order.splice(order.begin(), order, it->second);
+                hit_count++;
+                return it->second->second;
+            }
+        }
+        miss_count++;
+        Entry entry = build(tokens, variables);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(name);
+        if (it != index.end()) { // другой поток успел раньше
+            order.splice(order.begin(), order, it->second);
+            return it->second->second;
+        }
+        order.emplace_front(name, entry);
+        index.emplace(std::move(name), order.begin());
+        if (order.size() > limit) {
+            index.erase(order.back().first);
+            order.pop_back();
+        }
+        return entry;
+    }
+
+    size_t hits() const { return hit_count; }
+    size_t misses() const { return miss_count; }
+    size_t capacity() const { return limit; }
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return order.size();
+    }
+    void clear() { // счетчики не сбрасываются
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        order.clear();
+    }
+};
+
+#endif // EXPRESSIONCACHE_H
@@ -0,0 +1,98 @@
+#ifndef EXPRESSIONFILE_H
+#define EXPRESSIONFILE_H
+
+#include "Parser.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Файл, отображенный в память только для чтения (realization/ExpressionFile.cpp)
+class MappedFile {
+    const char *data = nullptr;
+    size_t length = 0;
+
+public:
+    explicit MappedFile(const std::string &path); // нет файла - runtime_error
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::string_view text() const { return {data, length}; }
+};
+
+struct LineError {
+    size_t line; // с 1
+    std::string message;
+};
+
+// Выражения по строкам: expressions[i] - строка i + 1; nullptr - пустая строка или ошибка
+template <typename T>
+struct ParsedLines {
+    std::vector<std::shared_ptr<Expression<T>>> expressions;
+    std::vector<LineError> errors; // по возрастанию номера строки
+};
+
+// Разбор по одному выражению на строку на всех потоках pool. Текст режется на куски
+// по границам строк, каждый кусок разбирается целиком одним потоком; номера строк
+// восстанавливаются по числу строк в предыдущих кусках. Узлы создаются в фабрике
+// разобравшего потока, поэтому одинаковые выражения из разных кусков могут не совпасть.
+template <typename T>
+ParsedLines<T> parse_lines(std::string_view text, ThreadPool &pool) {
+    // Границы кусков: примерно равные по байтам, сдвинутые к началу следующей строки
+    size_t parts = std::max<size_t>(1, std::min(text.size() / 4096, pool.size() * 8));
+    std::vector<size_t> bounds{0};
+    for (size_t i = 1; i < parts; ++i) {
+        size_t at = std::max(bounds.back(), text.size() * i / parts);
+        auto newline = text.find('\n', at);
+        if (newline == std::string_view::npos) break;
+        bounds.push_back(newline + 1);
+    }
+    bounds.push_back(text.size());
+
+    std::vector<ParsedLines<T>> chunks(bounds.size() - 1); // номера строк - внутри куска
+    pool.parallel_for(chunks.size(), [&](size_t c) {
+        auto &chunk = chunks[c];
+        size_t begin = bounds[c];
+        while (begin < bounds[c + 1]) {
+            const char *newline = static_cast<const char *>(
+                std::memchr(text.data() + begin, '\n', bounds[c + 1] - begin));
+            size_t end = newline ? newline - text.data() : bounds[c + 1];
+            auto line = text.substr(begin, end - begin);
+            begin = end + 1;
+
+            std::shared_ptr<Expression<T>> expr;
+            if (line.find_first_not_of(" \t\r\v\f") != std::string_view::npos) {
+                try {
+                    expr = Parser<T>(line).parse();
+                } catch (const std::exception &error) {
+                    chunk.errors.push_back({chunk.expressions.size() + 1, error.what()});
+                }
+            }
+            chunk.expressions.push_back(std::move(expr));
+        }
+    });
+
+    ParsedLines<T> result;
+    for (auto &chunk : chunks) {
+        for (auto &error : chunk.errors) {
+            error.line += result.expressions.size();
+            result.errors.push_back(std::move(error));
+        }
+        result.expressions.insert(result.expressions.end(), std::make_move_iterator(chunk.expressions.begin()),
+                                  std::make_move_iterator(chunk.expressions.end()));
+    }
+    return result;
+}
+
+template <typename T>
+ParsedLines<T> parse_file(const std::string &path, ThreadPool &pool) {
+    MappedFile file(path);
+    return parse_lines<T>(file.text(), pool);
+}
+
+#endif // EXPRESSIONFILE_H
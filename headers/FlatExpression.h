@@ -0,0 +1,348 @@
+#ifndef FLATEXPRESSION_H
+#define FLATEXPRESSION_H
+
+#include "Expression.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum FlatKind : uint8_t { FLAT_CONST, FLAT_VAR, FLAT_MONO, FLAT_BINARY };
+
+// 12 байт на узел вместо ~80 у BinaryExpression (vtable, два shared_ptr, блок управления)
+struct FlatNode {
+    FlatKind kind;
+    uint8_t op;     // Function или Operation
+    uint32_t left;  // FLAT_CONST - номер константы, FLAT_VAR - номер имени, иначе - аргумент
+    uint32_t right; // второй аргумент FLAT_BINARY
+    bool operator==(const FlatNode &other) const = default;
+};
+
+struct FlatNodeHash {
+    size_t operator()(const FlatNode &node) const {
+        size_t h = std::hash<uint32_t>()(node.left);
+        h = h * 31 + std::hash<uint32_t>()(node.right);
+        return h * 31 + static_cast<size_t>(node.kind * 8 + node.op);
+    }
+};
+
+// Выражение в одном векторе небольших узлов. Дети всегда стоят раньше родителя,
+// поэтому каждый проход (eval, diff, optimize, to_string) - один цикл по вектору.
+// Одинаковые узлы хранятся один раз, в векторе только узлы, достижимые из корня.
+// Правила diff и optimize те же, что у дерева, и to_string дает ту же строку.
+template <typename T>
+class FlatExpression {
+public:
+    std::vector<FlatNode> nodes;
+    std::vector<T> constants;
+    std::vector<std::string> names; // имена переменных по номерам
+
+    FlatExpression() = default;
+    explicit FlatExpression(const std::shared_ptr<Expression<T>> &expr) {
+        Builder builder(*this);
+        std::unordered_map<const Expression<T> *, uint32_t> index;
+        builder.set_root(convert(expr.get(), builder, index));
+    }
+
+    uint32_t root() const { return static_cast<uint32_t>(nodes.size() - 1); }
+
+    T eval(std::map<std::string, T> &parameters) const {
+        std::vector<T> values;
+        values.reserve(names.size());
+        for (const auto &name : names) values.push_back(parameters[name]); // отсутствующая переменная = 0
+        return eval(std::span<const T>(values));
+    }
+
+    // Значения переменных по номерам names
+    T eval(std::span<const T> values) const {
+        if (values.size() < names.size()) {
+            throw std::runtime_error("Expected " + std::to_string(names.size()) + " values");
+        }
+        std::vector<T> result(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const auto &node = nodes[i];
+            switch (node.kind) {
+                case FLAT_CONST: result[i] = constants[node.left]; break;
+                case FLAT_VAR: result[i] = values[node.left]; break;
+                case FLAT_MONO: result[i] = apply_function(static_cast<Function>(node.op), result[node.left]); break;
+                case FLAT_BINARY:
+                    result[i] = apply_operation(static_cast<Operation>(node.op), result[node.left], result[node.right]);
+                    break;
+            }
+        }
+        return result.back();
+    }
+
+    FlatExpression diff(const std::string &var) const {
+        FlatExpression result;
+        Builder b(result);
+        std::vector<uint32_t> self(nodes.size()), d(nodes.size());
+        auto found = std::find(names.begin(), names.end(), var);
+        auto var_index = static_cast<uint32_t>(found - names.begin()); // дальше сравниваются номера
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const auto &node = nodes[i];
+            self[i] = b.copy(*this, node, self);
+            switch (node.kind) {
+                case FLAT_CONST: d[i] = b.constant(T(0)); break;
+                case FLAT_VAR: d[i] = b.constant(node.left == var_index ? T(1) : T(0)); break;
+                case FLAT_MONO: d[i] = mono_diff(b, static_cast<Function>(node.op), self[node.left], d[node.left]); break;
+                case FLAT_BINARY:
+                    d[i] = binary_diff(b, node, self[node.left], self[node.right], d[node.left], d[node.right]);
+                    break;
+            }
+        }
+        b.set_root(d.back());
+        return result;
+    }
+
+    FlatExpression optimize() const {
+        FlatExpression result;
+        Builder b(result);
+        std::vector<uint32_t> opt(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const auto &node = nodes[i];
+            if (node.kind == FLAT_BINARY) {
+                opt[i] = optimize_binary(b, result, static_cast<Operation>(node.op), opt[node.left], opt[node.right]);
+            } else {
+                opt[i] = b.copy(*this, node, opt);
+            }
+        }
+        b.set_root(opt.back());
+        return result;
+    }
+
+    std::string to_string() const {
+        static const char *functions[] = {"sin", "cos", "ln", "exp"};
+        static const char *operations[] = {" + ", " - ", " * ", " / ", "^"};
+        std::vector<std::string> text(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const auto &node = nodes[i];
+            switch (node.kind) {
+                case FLAT_CONST: text[i] = ConstantExpression<T>(constants[node.left]).to_string(); break;
+                case FLAT_VAR: text[i] = names[node.left]; break;
+                case FLAT_MONO:
+                    // у бинарного аргумента скобки уже есть
+                    if (nodes[node.left].kind == FLAT_BINARY) text[i] = functions[node.op] + text[node.left];
+                    else text[i] = std::string(functions[node.op]) + "(" + text[node.left] + ")";
+                    break;
+                case FLAT_BINARY:
+                    text[i] = "(" + text[node.left] + operations[node.op] + text[node.right] + ")";
+                    break;
+            }
+        }
+        return text.back();
+    }
+
+    // Обратно в дерево (через make_*, узлы общие)
+    std::shared_ptr<Expression<T>> to_expression() const {
+        std::vector<std::shared_ptr<Expression<T>>> result(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const auto &node = nodes[i];
+            switch (node.kind) {
+                case FLAT_CONST: result[i] = make_constant(constants[node.left]); break;
+                case FLAT_VAR: result[i] = make_var<T>(names[node.left]); break;
+                case FLAT_MONO: result[i] = make_mono(result[node.left], static_cast<Function>(node.op)); break;
+                case FLAT_BINARY:
+                    result[i] = make_binary(result[node.left], result[node.right], static_cast<Operation>(node.op));
+                    break;
+            }
+        }
+        return result.back();
+    }
+
+private:
+    // Собирает выражение с хеш-консингом; set_root оставляет только достижимые узлы
+    class Builder {
+        FlatExpression &out;
+        std::unordered_map<FlatNode, uint32_t, FlatNodeHash> index;
+        std::unordered_map<std::string, uint32_t> constant_index; // по байтам значения
+        std::unordered_map<std::string, uint32_t> name_index;
+
+    public:
+        explicit Builder(FlatExpression &out) : out(out) {}
+
+        uint32_t add(const FlatNode &node) {
+            auto [it, inserted] = index.emplace(node, static_cast<uint32_t>(out.nodes.size()));
+            if (inserted) out.nodes.push_back(node);
+            return it->second;
+        }
+        uint32_t constant(const T &value) {
+            std::string bytes(sizeof(T), '\0');
+            std::memcpy(bytes.data(), &value, sizeof(T));
+            auto [it, inserted] = constant_index.emplace(bytes, static_cast<uint32_t>(out.constants.size()));
+            if (inserted) out.constants.push_back(value);
+            return add({FLAT_CONST, 0, it->second, 0});
+        }
+        uint32_t var(const std::string &name) {
+            auto [it, inserted] = name_index.emplace(name, static_cast<uint32_t>(out.names.size()));
+            if (inserted) out.names.push_back(name);
+            return add({FLAT_VAR, 0, it->second, 0});
+        }
+        uint32_t mono(uint32_t arg, Function func) {
+            return add({FLAT_MONO, static_cast<uint8_t>(func), arg, 0});
+        }
+        uint32_t binary(uint32_t left, uint32_t right, Operation op) {
+            return add({FLAT_BINARY, static_cast<uint8_t>(op), left, right});
+        }
+        // Узел другого выражения с уже перенесенными детьми (map: старый номер -> новый)
+        uint32_t copy(const FlatExpression &from, const FlatNode &node, const std::vector<uint32_t> &map) {
+            switch (node.kind) {
+                case FLAT_CONST: return constant(from.constants[node.left]);
+                case FLAT_VAR: return var(from.names[node.left]);
+                case FLAT_MONO: return mono(map[node.left], static_cast<Function>(node.op));
+                default: return binary(map[node.left], map[node.right], static_cast<Operation>(node.op));
+            }
+        }
+
+        // Корень становится последним узлом; недостижимые узлы, константы и имена убираются
+        void set_root(uint32_t root) {
+            std::vector<char> used(out.nodes.size(), 0);
+            used[root] = 1;
+            for (size_t i = root + 1; i-- > 0;) {
+                if (!used[i]) continue;
+                const auto &node = out.nodes[i];
+                if (node.kind == FLAT_MONO) used[node.left] = 1;
+                if (node.kind == FLAT_BINARY) used[node.left] = used[node.right] = 1;
+            }
+            std::vector<uint32_t> position(out.nodes.size());
+            std::vector<uint32_t> constant_position(out.constants.size(), UINT32_MAX), name_position(out.names.size(), UINT32_MAX);
+            std::vector<FlatNode> nodes;
+            std::vector<T> constants;
+            std::vector<std::string> names;
+            for (size_t i = 0; i <= root; ++i) {
+                if (!used[i]) continue;
+                FlatNode node = out.nodes[i];
+                switch (node.kind) {
+                    case FLAT_CONST:
+                        if (constant_position[node.left] == UINT32_MAX) {
+                            constant_position[node.left] = static_cast<uint32_t>(constants.size());
+                            constants.push_back(out.constants[node.left]);
+                        }
+                        node.left = constant_position[node.left];
+                        break;
+                    case FLAT_VAR:
+                        if (name_position[node.left] == UINT32_MAX) {
+                            name_position[node.left] = static_cast<uint32_t>(names.size());
+                            names.push_back(std::move(out.names[node.left]));
+                        }
+                        node.left = name_position[node.left];
+                        break;
+                    case FLAT_MONO: node.left = position[node.left]; break;
+                    case FLAT_BINARY: node.left = position[node.left]; node.right = position[node.right]; break;
+                }
+                position[i] = static_cast<uint32_t>(nodes.size());
+                nodes.push_back(node);
+            }
+            out.nodes = std::move(nodes);
+            out.constants = std::move(constants);
+            out.names = std::move(names);
+            index.clear();
+            constant_index.clear();
+            name_index.clear();
+        }
+    };
+
+    static uint32_t convert(Expression<T> *expr, Builder &b, std::unordered_map<const Expression<T> *, uint32_t> &index) {
+        post_order(expr, [&](Expression<T> *node) { return index.count(node) > 0; }, [&](Expression<T> *node) {
+            uint32_t result;
+            if (auto constant = dynamic_cast<ConstantExpression<T> *>(node)) {
+                result = b.constant(constant->value);
+            } else if (auto var = dynamic_cast<VarExpression<T> *>(node)) {
+                result = b.var(symbol_name(var->symbol));
+            } else if (auto mono = dynamic_cast<MonoExpression<T> *>(node)) {
+                result = b.mono(index.at(mono->expr.get()), mono->func);
+            } else if (auto binary = dynamic_cast<BinaryExpression<T> *>(node)) {
+                result = b.binary(index.at(binary->left.get()), index.at(binary->right.get()), binary->op);
+            } else {
+                throw std::runtime_error("Unknown expression");
+            }
+            index.emplace(node, result);
+        });
+        return index.at(expr);
+    }
+
+    // Те же правила, что MonoExpression::derive
+    static uint32_t mono_diff(Builder &b, Function func, uint32_t arg, uint32_t d) {
+        switch (func) {
+            case SIN: return b.binary(b.mono(arg, COS), d, MULT);
+            case COS: return b.binary(b.binary(b.constant(T(-1)), b.mono(arg, SIN), MULT), d, MULT);
+            case LN: return b.binary(d, arg, DIV);
+            case EXP: return b.binary(b.mono(arg, EXP), d, MULT);
+            default: throw std::runtime_error("Unknown function");
+        }
+    }
+
+    // Те же правила, что BinaryExpression::derive
+    uint32_t binary_diff(Builder &b, const FlatNode &node, uint32_t left, uint32_t right,
+                         uint32_t left_diff, uint32_t right_diff) const {
+        switch (static_cast<Operation>(node.op)) {
+            case PLUS: return b.binary(left_diff, right_diff, PLUS);
+            case MINUS: return b.binary(left_diff, right_diff, MINUS);
+            case MULT: return b.binary(b.binary(left_diff, right, MULT), b.binary(left, right_diff, MULT), PLUS);
+            case DIV: {
+                auto numerator = b.binary(b.binary(left_diff, right, MULT), b.binary(left, right_diff, MULT), MINUS);
+                return b.binary(numerator, b.binary(right, b.constant(T(2)), POW), DIV);
+            }
+            case POW:
+                if constexpr (!std::is_same_v<T, std::complex<double>>) {
+                    // f(x) ^ const
+                    if (nodes[node.right].kind == FLAT_CONST) {
+                        T power = constants[nodes[node.right].left];
+                        if (power > T(1)) {
+                            auto multiplier = b.binary(left, b.constant(power - T(1)), POW);
+                            return b.binary(right, b.binary(multiplier, left_diff, MULT), MULT);
+                        }
+                        if (power == 1) return b.constant(T(1));
+                        auto multiplier = b.binary(right, left_diff, MULT);
+                        return b.binary(multiplier, b.binary(left, b.constant(T(std::abs(power) + T(1))), POW), DIV);
+                    }
+                    // const ^ f(x)
+                    if (nodes[node.left].kind == FLAT_CONST) {
+                        return b.binary(right_diff, b.binary(b.binary(left, right, POW), b.mono(left, LN), MULT), MULT);
+                    }
+                    // f(x) ^ g(x)
+                    auto term1 = b.binary(right_diff, b.mono(left, LN), MULT);
+                    auto term2 = b.binary(right, b.binary(left_diff, left, DIV), MULT);
+                    return b.binary(term1, term2, PLUS);
+                }
+                [[fallthrough]];
+            default: throw std::runtime_error("Unknown operation");
+        }
+    }
+
+    // Те же правила, что optimize для дерева
+    static uint32_t optimize_binary(Builder &b, const FlatExpression &out, Operation op, uint32_t left, uint32_t right) {
+        bool left_const = out.nodes[left].kind == FLAT_CONST, right_const = out.nodes[right].kind == FLAT_CONST;
+        T l = left_const ? out.constants[out.nodes[left].left] : T(0);
+        T r = right_const ? out.constants[out.nodes[right].left] : T(0);
+        if (op == PLUS || op == MINUS) {
+            if (left_const && right_const) {
+                if (l == T(0) || r == T(0)) return b.constant(apply_operation(op, l, r));
+            } else if (left_const) {
+                if (l == T(0)) return op == MINUS ? b.binary(b.constant(T(-1)), right, MULT) : right;
+            } else if (right_const) {
+                if (r == T(0)) return left;
+            }
+        }
+        if (op == MULT || op == DIV) {
+            if (left_const && right_const) {
+                if (op == DIV && r == T(0)) throw std::runtime_error("Division by zero");
+                if (l == T(0) || r == T(0)) return b.constant(T(0));
+                if (l == T(1) || r == T(1)) return b.constant(apply_operation(op, l, r));
+            } else if (left_const) {
+                if (l == T(0)) return b.constant(T(0));
+                if (l == T(1) && op == MULT) return right;
+            } else if (right_const) {
+                if (r == T(0)) return b.constant(T(0));
+                if (r == T(1)) return left;
+            }
+        }
+        return b.binary(left, right, op);
+    }
+};
+
+#endif // FLATEXPRESSION_H
@@ -0,0 +1,72 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "Expression.h"
+#include <cstddef>
+#include <string>
+
+// Векторные реализации функций для пакетного подсчета Expression<double>:
+// out[i] = func(in[i]), i < n. in и out могут совпадать.
+//
+// Погрешность относительно точного значения (измерена против long double):
+//   exp: <= 1.2 ULP (с FMA <= 0.9 ULP), включая денормализованные результаты
+//   ln:  <= 0.9 ULP для всех положительных x, включая денормализованные
+//   sin, cos: <= 1.5 ULP при |x| <= 10, <= 2.5 ULP при |x| < 2^20;
+//             для больших |x|, inf и nan - скалярные std::sin/std::cos
+// Вне GCC/Clang на x86 доступен только скалярный вариант через std.
+// Особые значения совпадают с std: ln(0) = -inf, ln(x < 0) = nan, exp(-inf) = 0, nan -> nan.
+void vector_function(Function func, const double *in, double *out, size_t n);
+
+// out[i] = left[i] op right[i]; деление на ноль не проверяется (это делает Program)
+void vector_operation(Operation op, const double *left, const double *right, double *out, size_t n);
+
+// Комплексные варианты: действительные и мнимые части в отдельных массивах (re[i] + i im[i]).
+// Сложение и вычитание точны; умножение, деление (алгоритм Смита), exp, ln, sin, cos
+// собраны из действительных ядер выше: погрешность до 4e-16 относительно модуля результата.
+// inf и nan во входных данных, а также большие аргументы считаются через std::complex.
+// POW всегда скалярный.
+void vector_complex_function(Function func, const double *re, const double *im,
+                             double *out_re, double *out_im, size_t n);
+void vector_complex_operation(Operation op, const double *left_re, const double *left_im,
+                              const double *right_re, const double *right_im,
+                              double *out_re, double *out_im, size_t n);
+
+// Классы символов лексера. Только ASCII и без учета локали: пробельные - как std::isspace в "C".
+enum CharClass { SPACE_CHARS, DIGIT_CHARS, NUMBER_CHARS /* цифры и '.' */, ALPHA_CHARS };
+
+inline bool char_in_class(CharClass cls, unsigned char c) {
+    switch (cls) {
+        case SPACE_CHARS: return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+        case DIGIT_CHARS: return static_cast<unsigned char>(c - '0') <= 9;
+        case NUMBER_CHARS: return static_cast<unsigned char>(c - '0') <= 9 || c == '.';
+        case ALPHA_CHARS: return static_cast<unsigned char>((c | 0x20) - 'a') <= 'z' - 'a';
+    }
+    return false;
+}
+
+// Длина начального отрезка text[0, n) из символов класса cls (сразу по 16/32 байта)
+size_t char_span(CharClass cls, const char *text, size_t n);
+
+// Уровни ядер. Выбирается один раз при первом использовании: лучший из поддерживаемых
+// процессором, либо более низкий из переменной окружения EXPRESSION_KERNELS
+// (scalar, sse2, avx2, avx512). Повысить уровень через переменную нельзя.
+enum KernelSet { SCALAR_KERNELS, SSE2_KERNELS, AVX2_KERNELS, AVX512_KERNELS };
+
+struct KernelTable {
+    KernelSet set;
+    void (*function)(Function func, const double *in, double *out, size_t n);
+    void (*operation)(Operation op, const double *left, const double *right, double *out, size_t n);
+    void (*complex_function)(Function func, const double *re, const double *im,
+                             double *out_re, double *out_im, size_t n);
+    void (*complex_operation)(Operation op, const double *left_re, const double *left_im,
+                              const double *right_re, const double *right_im,
+                              double *out_re, double *out_im, size_t n);
+    size_t (*span)(CharClass cls, const char *text, size_t n);
+};
+
+KernelSet supported_kernel_set();
+const KernelTable &kernel_table(KernelSet set); // конкретный уровень; выше поддерживаемого - ошибка
+const KernelTable &active_kernels();
+std::string kernel_set_name(KernelSet set);
+
+#endif // KERNELS_H
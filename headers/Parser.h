@@ -3,132 +3,162 @@
 
 #include "Expression.h"
 #include "Tokenator.h"
+#include <optional>
 #include <stdexcept>
+#include <string_view>
 
+// Токены берутся либо из готового вектора, либо прямо из строки через Lexer -
+// тогда вектора нет вовсе и память сверх дерева не растет с длиной входа.
 template<typename T>
 class Parser {
     std::vector<Token> tokens;
     size_t current = 0;
+    std::optional<Lexer> lexer; // разбор строки по требованию
+    std::optional<Token> next;  // следующий токен, если уже прочитан
     size_t cnt_par = 0; // счетчик скобок
 
-    Token watch() const {
-        if (current < tokens.size()) {
-            return tokens[current];
+    bool has_token() { // есть ли еще токены; читает следующий при необходимости
+        if (next) return true;
+        if (lexer) {
+            Token token(NUMBER, "");
+            if (lexer->next(token)) next = token;
+        } else if (current < tokens.size()) {
+            next = tokens[current++];
         }
-        throw std::runtime_error("Unexpected end of input");
+        return next.has_value();
     }
 
-    Token consume() {
-        if (current < tokens.size()) {
-            return tokens[current++];
+    const Token &watch() {
+        if (has_token()) {
+            return *next;
         }
         throw std::runtime_error("Unexpected end of input");
     }
 
-    bool ismatch(TokenType type) { // для проверки существования ')', как парной к '('
-        if (current < tokens.size() && tokens[current].type == type) {
-            current++;
-            return true;
+    Token consume() {
+        if (has_token()) {
+            Token token = *next;
+            next.reset();
+            return token;
         }
-        return false;
+        throw std::runtime_error("Unexpected end of input");
     }
 
     // --- Основные методы парсера ---
-    std::shared_ptr<Expression<T> > parseExpression() {
-        return parseBinary(0);
+    // Разбор без рекурсии: операнды и отложенные операции/скобки/функции лежат в своих стеках,
+    // поэтому глубина вложенности ограничена только памятью. Приоритеты - из operators,
+    // все операции левоассоциативны, функция применяется к следующему первичному выражению.
+    enum PendingKind { PENDING_OPERATION, PENDING_PAREN, PENDING_FUNCTION };
+    struct Pending {
+        PendingKind kind;
+        int code; // Operation или Function
+        int priority;
+    };
+
+    std::vector<std::shared_ptr<Expression<T> > > operands;
+    std::vector<Pending> pending;
+
+    void reduce_operation() {
+        auto right = std::move(operands.back());
+        operands.pop_back();
+        operands.back() = make_binary(operands.back(), right, static_cast<Operation>(pending.back().code));
+        pending.pop_back();
     }
 
-    // Парсит и может принимать бин операции
-    std::shared_ptr<Expression<T> > parseBinary(int minPriority) {
-        auto left = parsePrimary();
-
-        while (true) {
-            if (current >= tokens.size()) {
-                break;
-            }
-
-            auto token = watch();
-            if (token.type != OPERATOR) {
-                switch (token.type) {
-                    case RIGHT_PAREN: {
-                        if (!cnt_par) throw std::runtime_error("Extra ')'");
-                        break;
-                    }
-                    default: throw std::runtime_error("Expected operation");
-                }
-                break; // если скобка ")", но она не лишняя
-            }
-
-            operators op(token.value == "+"
-                             ? PLUS
-                             : token.value == "-"
-                                   ? MINUS
-                                   : token.value == "*"
-                                         ? MULT
-                                         : token.value == "/"
-                                               ? DIV
-                                               : token.value == "^"
-                                                     ? POW
-                                                     : PLUS);
-
-            if (op.priority < minPriority) {
-                break; // приоритет операции меньше минимального => возвращаемся к меньшим приоритетам операции
-            }
-
-            consume(); // удовлетворяющая операция => съедаем ее (тк уже записали ее в op)
-            auto right = parseBinary(op.priority + 1);
-            left = std::make_shared<BinaryExpression<T> >(left, right, op.type);
+    // Первичное выражение готово: применяем ожидающие его функции
+    void finish_primary() {
+        while (!pending.empty() && pending.back().kind == PENDING_FUNCTION) {
+            operands.back() = make_mono(operands.back(), static_cast<Function>(pending.back().code));
+            pending.pop_back();
         }
-
-        return left;
     }
 
-    // Вспомогательный метод парсера, который парсит
-    std::shared_ptr<Expression<T> > parsePrimary() {
-        if (current >= tokens.size()) {
-            throw std::runtime_error("Unexpected end of input in parsePrimary");
-        }
+    static double number(const Token &token) {
+        auto value = parse_number(token.value);
+        if (!value) throw std::runtime_error("Malformed number: " + std::string(token.value));
+        return *value;
+    }
 
-        auto token = consume(); // работаем со след токеном
+    std::shared_ptr<Expression<T> > parseLeaf(const Token &token) {
         switch (token.type) {
-            case NUMBER: return std::make_shared<ConstantExpression<T> >(std::stod(token.value));
+            case NUMBER: return make_constant<T>(number(token));
             case COMPLEX: {
                 if constexpr (std::is_same_v<T, std::complex<double>>) { // для нормального компила
-                    return std::make_shared<ConstantExpression<T> >(std::complex<double>(0, std::stod(token.value)));
+                    return make_constant<T>(std::complex<double>(0, number(token)));
                 } else {
-                    return std::make_shared<ConstantExpression<T> >(std::stod(token.value));
+                    return make_constant<T>(number(token));
                 }
             }
-            case VARIABLE: return std::make_shared<VarExpression<T> >(token.value);
-            case FUNCTION: {
-                auto arg = parsePrimary(); // тк ожидается скобка '(    '
-                Function func = token.value == "sin"
-                                    ? SIN
-                                    : token.value == "cos"
-                                          ? COS
-                                          : token.value == "ln"
-                                                ? LN
-                                                : token.value == "exp"
-                                                      ? EXP
-                                                      : SIN;
-                return std::make_shared<MonoExpression<T> >(arg, func);
+            default: return make_var<T>(to_lower(token.value));
+        }
+    }
+
+    std::shared_ptr<Expression<T> > parseExpression() {
+        operands.clear();
+        pending.clear();
+        bool expect_primary = true;
+        while (true) {
+            if (expect_primary) {
+                if (!has_token()) {
+                    throw std::runtime_error("Unexpected end of input in parsePrimary");
+                }
+                auto token = consume(); // работаем со след токеном
+                switch (token.type) {
+                    case NUMBER: case COMPLEX: case VARIABLE:
+                        operands.push_back(parseLeaf(token));
+                        finish_primary();
+                        expect_primary = false;
+                        break;
+                    case FUNCTION: // аргумент - следующее первичное выражение
+                        pending.push_back({PENDING_FUNCTION, token.code, 0});
+                        break;
+                    case LEFT_PAREN:
+                        cnt_par++;
+                        pending.push_back({PENDING_PAREN, 0, 0});
+                        break;
+                    default:
+                        throw std::runtime_error("Unexpected token: " + std::string(token.value));
+                }
+                continue;
+            }
+
+            if (!has_token()) {
+                while (!pending.empty()) {
+                    if (pending.back().kind == PENDING_PAREN) throw std::runtime_error("Expected ')'");
+                    reduce_operation();
+                }
+                return operands.back();
             }
-            case LEFT_PAREN: {
-                cnt_par++;
-                auto expr = parseExpression();
-                if (!ismatch(RIGHT_PAREN)) {
-                    throw std::runtime_error("Expected ')'");
+
+            const auto &token = watch();
+            if (token.type == OPERATOR) {
+                operators op(static_cast<Operation>(token.code)); // операция распознана при разборе на токены
+                // левая часть готова для всех операций с приоритетом не ниже текущего
+                while (!pending.empty() && pending.back().kind == PENDING_OPERATION &&
+                       pending.back().priority >= op.priority) {
+                    reduce_operation();
+                }
+                pending.push_back({PENDING_OPERATION, op.type, op.priority});
+                consume();
+                expect_primary = true;
+            } else if (token.type == RIGHT_PAREN) {
+                if (!cnt_par) throw std::runtime_error("Extra ')'");
+                while (pending.back().kind != PENDING_PAREN) {
+                    reduce_operation();
                 }
+                pending.pop_back();
+                consume();
                 cnt_par--;
-                return expr;
+                finish_primary(); // выражение в скобках - первичное
+            } else {
+                throw std::runtime_error("Expected operation");
             }
-            default:
-                throw std::runtime_error("Unexpected token: " + token.value);
         }
     }
 
 public:
     explicit Parser(const std::vector<Token> &tokens) : tokens(tokens) {}
+    explicit Parser(std::string_view input) : lexer(std::in_place, input) {} // input должен жить до конца parse
 
     std::shared_ptr<Expression<T> > parse() {
         return parseExpression();
@@ -0,0 +1,642 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "Dual.h"
+#include "Expression.h"
+#include "Kernels.h"
+#include "Taylor.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <map>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Плоское представление выражения: постфиксная запись + пул констант.
+// Вычисляется одним циклом без виртуальных вызовов и обхода указателей.
+// Общие узлы DAG (после diff и хеш-консинга) считаются один раз: результат
+// сохраняется во временную ячейку и дальше берется из нее.
+enum OpCode {
+    PUSH_CONST, // положить константу constants[arg]
+    PUSH_VAR,   // положить значение переменной из слота arg
+    CALL_FUNC,  // применить функцию (Function)arg к вершине стека
+    APPLY_OP,   // применить операцию (Operation)arg к двум верхним значениям
+    STORE,      // скопировать вершину стека во временную ячейку arg
+    LOAD        // положить значение временной ячейки arg
+};
+
+struct Instruction {
+    OpCode code;
+    int arg;
+};
+
+enum JacobianMode { AUTO_MODE, FORWARD_MODE, REVERSE_MODE };
+
+template <typename T>
+struct Program {
+    std::vector<Instruction> code;
+    std::vector<T> constants;
+    std::vector<std::string> variables; // имена переменных по номерам слотов
+    size_t depth = 0; // максимальная глубина стека
+    size_t temps = 0; // число временных ячеек для общих узлов
+    size_t outputs = 1; // значений на стеке в конце; eval и eval_batch возвращают первое
+
+    T eval(std::map<std::string, T> &parameters) const {
+        std::vector<T> values;
+        values.reserve(variables.size());
+        for (const auto &name : variables) {
+            values.push_back(parameters[name]); // как и VarExpression: отсутствующая переменная = 0
+        }
+        return run(values.data());
+    }
+
+    // Значения переменных по слотам (порядок variables, либо заданный через bind)
+    T eval(std::span<const T> values) const {
+        if (values.size() < variables.size()) {
+            throw std::runtime_error("Expected " + std::to_string(variables.size()) + " values");
+        }
+        return run(values.data());
+    }
+
+    // Прямой режим: значения переменных - дуальные числа, derivative задает направление.
+    // Результат - значение и производная по этому направлению за один проход;
+    // при depth + temps <= SMALL_STACK память не выделяется.
+    Dual<T> eval(std::span<const Dual<T>> values) const {
+        if (values.size() < variables.size()) {
+            throw std::runtime_error("Expected " + std::to_string(variables.size()) + " values");
+        }
+        return run(values.data());
+    }
+
+    // Производная по переменной var в точке parameters
+    T derivative(std::map<std::string, T> &parameters, const std::string &var) const {
+        std::vector<Dual<T>> values;
+        values.reserve(variables.size());
+        for (const auto &name : variables) {
+            values.emplace_back(parameters[name], name == var ? T(1) : T(0));
+        }
+        return run(values.data()).derivative;
+    }
+
+    // Производные по var порядков 0..order в точке parameters: один проход по рядам
+    // Тейлора (Taylor.h) вместо order вложенных diff
+    std::vector<T> derivatives(std::map<std::string, T> &parameters, const std::string &var, size_t order) const {
+        std::vector<Taylor<T>> values;
+        values.reserve(variables.size());
+        for (const auto &name : variables) {
+            values.push_back(name == var ? Taylor<T>::variable(parameters[name], order) : Taylor<T>(parameters[name]));
+        }
+        Taylor<T> series = run(values.data());
+        std::vector<T> result(order + 1);
+        double factorial = 1;
+        for (size_t n = 0; n <= order; ++n) {
+            if (n > 0) factorial *= static_cast<double>(n);
+            result[n] = series[n] * T(factorial);
+        }
+        return result;
+    }
+
+    // Обратный режим: значение и все частные производные за один проход вперед
+    // и один назад. grad[slot] - производная по переменной слота slot.
+    T gradient(std::span<const T> values, std::span<T> grad) const {
+        if (values.size() < variables.size()) {
+            throw std::runtime_error("Expected " + std::to_string(variables.size()) + " values");
+        }
+        if (grad.size() < variables.size()) {
+            throw std::runtime_error("Expected " + std::to_string(variables.size()) + " gradient slots");
+        }
+        Tape tape = record(values.data());
+        sweep(tape, tape.roots[0], grad.data());
+        return tape.values[tape.roots[0]];
+    }
+
+    // Значения всех выходов (программа системы, см. compile для вектора выражений)
+    void eval(std::span<const T> values, std::span<T> out) const {
+        if (values.size() < variables.size()) {
+            throw std::runtime_error("Expected " + std::to_string(variables.size()) + " values");
+        }
+        if (out.size() < outputs) throw std::runtime_error("Expected " + std::to_string(outputs) + " outputs");
+        std::vector<T> stack(depth + temps);
+        run(values.data(), stack.data());
+        std::copy(stack.begin(), stack.begin() + outputs, out.begin());
+    }
+
+    // Матрица Якоби outputs x variables по строкам: out[i * variables.size() + j] = d выход i / d слот j.
+    // Прямой режим - проход с дуальными числами на каждую переменную, обратный - одна лента
+    // и проход назад на каждый выход; AUTO_MODE выбирает то, чего меньше.
+    void jacobian(std::span<const T> values, std::span<T> out, JacobianMode mode = AUTO_MODE) const {
+        size_t n = variables.size();
+        if (values.size() < n) throw std::runtime_error("Expected " + std::to_string(n) + " values");
+        if (out.size() < outputs * n) throw std::runtime_error("Expected " + std::to_string(outputs * n) + " entries");
+        if (mode == AUTO_MODE) mode = n <= outputs ? FORWARD_MODE : REVERSE_MODE;
+        if (mode == FORWARD_MODE) {
+            std::vector<Dual<T>> seeds(values.begin(), values.begin() + n), stack(depth + temps);
+            for (size_t j = 0; j < n; ++j) {
+                seeds[j].derivative = T(1);
+                run(seeds.data(), stack.data());
+                for (size_t i = 0; i < outputs; ++i) out[i * n + j] = stack[i].derivative;
+                seeds[j].derivative = T(0);
+            }
+            return;
+        }
+        Tape tape = record(values.data());
+        for (size_t i = 0; i < outputs; ++i) sweep(tape, tape.roots[i], out.data() + i * n);
+    }
+
+    // Градиент по всем переменным программы; как и eval, отсутствующая переменная = 0
+    std::map<std::string, T> gradient(std::map<std::string, T> &parameters) const {
+        std::vector<T> values, grad(variables.size());
+        values.reserve(variables.size());
+        for (const auto &name : variables) values.push_back(parameters[name]);
+        gradient(values, grad);
+        std::map<std::string, T> result;
+        for (size_t slot = 0; slot < variables.size(); ++slot) result[variables[slot]] = grad[slot];
+        return result;
+    }
+
+    // Пакетный подсчет: columns[slot][row] - значения переменных, out[row] - результат.
+    // Строки обрабатываются блоками по BLOCK: каждая инструкция проходит по всему блоку,
+    // поэтому диспетчеризация платится раз на блок, а циклы операций векторизуются компилятором.
+    void eval_batch(std::span<const std::span<const T>> columns, std::span<T> out) const {
+        if (columns.size() < variables.size()) {
+            throw std::runtime_error("Expected " + std::to_string(variables.size()) + " columns");
+        }
+        for (size_t slot = 0; slot < variables.size(); ++slot) {
+            if (columns[slot].size() < out.size()) throw std::runtime_error("Column is too short: " + variables[slot]);
+        }
+        std::vector<T> buffer(depth * BLOCK), saved(temps * BLOCK);
+        std::vector<const T *> stack(depth);
+        for (size_t begin = 0; begin < out.size(); begin += BLOCK) {
+            size_t n = std::min(BLOCK, out.size() - begin);
+            size_t top = 0;
+            for (const auto &ins : code) {
+                switch (ins.code) {
+                    case PUSH_CONST: {
+                        T *dst = buffer.data() + top * BLOCK;
+                        std::fill(dst, dst + n, constants[ins.arg]);
+                        stack[top++] = dst;
+                        break;
+                    }
+                    case PUSH_VAR:
+                        stack[top++] = columns[ins.arg].data() + begin; // без копирования
+                        break;
+                    case CALL_FUNC: {
+                        T *dst = buffer.data() + (top - 1) * BLOCK;
+                        batch_function(static_cast<Function>(ins.arg), stack[top - 1], dst, n);
+                        stack[top - 1] = dst;
+                        break;
+                    }
+                    case APPLY_OP: {
+                        --top;
+                        T *dst = buffer.data() + (top - 1) * BLOCK;
+                        batch_operation(static_cast<Operation>(ins.arg), stack[top - 1], stack[top], dst, n);
+                        stack[top - 1] = dst;
+                        break;
+                    }
+                    case STORE: {
+                        T *dst = saved.data() + ins.arg * BLOCK;
+                        std::copy(stack[top - 1], stack[top - 1] + n, dst);
+                        stack[top - 1] = dst; // ячейки не перезаписываются до следующего блока
+                        break;
+                    }
+                    case LOAD:
+                        stack[top++] = saved.data() + ins.arg * BLOCK;
+                        break;
+                }
+            }
+            std::copy(stack[0], stack[0] + n, out.data() + begin);
+        }
+    }
+
+    // Параллельный пакетный подсчет: строки делятся на куски по CHUNK и раздаются потокам пула.
+    // Каждая строка считается тем же кодом, что и в однопоточном варианте, - результат совпадает побайтно.
+    void eval_batch(std::span<const std::span<const T>> columns, std::span<T> out, ThreadPool &pool) const {
+        pool.parallel_for(chunks(out.size()), [&](size_t chunk) {
+            size_t begin = chunk * CHUNK, n = std::min(CHUNK, out.size() - begin);
+            std::vector<std::span<const T>> part;
+            part.reserve(columns.size());
+            for (const auto &column : columns) part.push_back(column.subspan(std::min(begin, column.size())));
+            eval_batch(part, out.subspan(begin, n));
+        });
+    }
+
+    // Пакетный подсчет для комплексных чисел с раздельным хранением частей:
+    // re[slot][row] + i im[slot][row] -> out_re[row] + i out_im[row].
+    // Операции и функции считаются векторными ядрами (Kernels.h) по каждой части.
+    void eval_batch(std::span<const std::span<const double>> re, std::span<const std::span<const double>> im,
+                    std::span<double> out_re, std::span<double> out_im) const
+        requires std::is_same_v<T, std::complex<double>> {
+        if (re.size() < variables.size() || im.size() < variables.size()) {
+            throw std::runtime_error("Expected " + std::to_string(variables.size()) + " columns");
+        }
+        if (out_im.size() != out_re.size()) throw std::runtime_error("Output parts differ in size");
+        for (size_t slot = 0; slot < variables.size(); ++slot) {
+            if (re[slot].size() < out_re.size() || im[slot].size() < out_re.size()) {
+                throw std::runtime_error("Column is too short: " + variables[slot]);
+            }
+        }
+        std::vector<double> buffer_re(depth * BLOCK), buffer_im(depth * BLOCK);
+        std::vector<double> saved_re(temps * BLOCK), saved_im(temps * BLOCK);
+        std::vector<const double *> stack_re(depth), stack_im(depth);
+        for (size_t begin = 0; begin < out_re.size(); begin += BLOCK) {
+            size_t n = std::min(BLOCK, out_re.size() - begin);
+            size_t top = 0;
+            for (const auto &ins : code) {
+                switch (ins.code) {
+                    case PUSH_CONST: {
+                        double *dst_re = buffer_re.data() + top * BLOCK, *dst_im = buffer_im.data() + top * BLOCK;
+                        std::fill(dst_re, dst_re + n, constants[ins.arg].real());
+                        std::fill(dst_im, dst_im + n, constants[ins.arg].imag());
+                        stack_re[top] = dst_re;
+                        stack_im[top++] = dst_im;
+                        break;
+                    }
+                    case PUSH_VAR:
+                        stack_re[top] = re[ins.arg].data() + begin;
+                        stack_im[top++] = im[ins.arg].data() + begin;
+                        break;
+                    case CALL_FUNC: {
+                        double *dst_re = buffer_re.data() + (top - 1) * BLOCK, *dst_im = buffer_im.data() + (top - 1) * BLOCK;
+                        vector_complex_function(static_cast<Function>(ins.arg), stack_re[top - 1], stack_im[top - 1],
+                                                dst_re, dst_im, n);
+                        stack_re[top - 1] = dst_re;
+                        stack_im[top - 1] = dst_im;
+                        break;
+                    }
+                    case APPLY_OP: {
+                        --top;
+                        double *dst_re = buffer_re.data() + (top - 1) * BLOCK, *dst_im = buffer_im.data() + (top - 1) * BLOCK;
+                        auto op = static_cast<Operation>(ins.arg);
+                        if (op == DIV) {
+                            bool zero = false;
+                            for (size_t i = 0; i < n; ++i) zero |= stack_re[top][i] == 0.0 && stack_im[top][i] == 0.0;
+                            if (zero) throw std::runtime_error("Division by zero");
+                        }
+                        vector_complex_operation(op, stack_re[top - 1], stack_im[top - 1], stack_re[top], stack_im[top],
+                                                 dst_re, dst_im, n);
+                        stack_re[top - 1] = dst_re;
+                        stack_im[top - 1] = dst_im;
+                        break;
+                    }
+                    case STORE: {
+                        double *dst_re = saved_re.data() + ins.arg * BLOCK, *dst_im = saved_im.data() + ins.arg * BLOCK;
+                        std::copy(stack_re[top - 1], stack_re[top - 1] + n, dst_re);
+                        std::copy(stack_im[top - 1], stack_im[top - 1] + n, dst_im);
+                        stack_re[top - 1] = dst_re;
+                        stack_im[top - 1] = dst_im;
+                        break;
+                    }
+                    case LOAD:
+                        stack_re[top] = saved_re.data() + ins.arg * BLOCK;
+                        stack_im[top++] = saved_im.data() + ins.arg * BLOCK;
+                        break;
+                }
+            }
+            std::copy(stack_re[0], stack_re[0] + n, out_re.data() + begin);
+            std::copy(stack_im[0], stack_im[0] + n, out_im.data() + begin);
+        }
+    }
+
+    void eval_batch(std::span<const std::span<const double>> re, std::span<const std::span<const double>> im,
+                    std::span<double> out_re, std::span<double> out_im, ThreadPool &pool) const
+        requires std::is_same_v<T, std::complex<double>> {
+        if (out_im.size() != out_re.size()) throw std::runtime_error("Output parts differ in size");
+        pool.parallel_for(chunks(out_re.size()), [&](size_t chunk) {
+            size_t begin = chunk * CHUNK, n = std::min(CHUNK, out_re.size() - begin);
+            std::vector<std::span<const double>> part_re, part_im;
+            for (const auto &column : re) part_re.push_back(column.subspan(std::min(begin, column.size())));
+            for (const auto &column : im) part_im.push_back(column.subspan(std::min(begin, column.size())));
+            eval_batch(part_re, part_im, out_re.subspan(begin, n), out_im.subspan(begin, n));
+        });
+    }
+
+    // Привязывает переменные к слотам в порядке names; неизвестная переменная - ошибка
+    void bind(const std::vector<std::string> &names) {
+        std::vector<int> remap;
+        remap.reserve(variables.size());
+        for (const auto &name : variables) {
+            auto it = std::find(names.begin(), names.end(), name);
+            if (it == names.end()) throw std::runtime_error("Unbound variable: " + name);
+            remap.push_back(static_cast<int>(it - names.begin()));
+        }
+        for (auto &ins : code) {
+            if (ins.code == PUSH_VAR) ins.arg = remap[ins.arg];
+        }
+        variables = names;
+    }
+
+    static constexpr size_t BLOCK = 1024;
+    static constexpr size_t CHUNK = 16 * BLOCK; // строк на задачу пула
+
+private:
+    static constexpr size_t SMALL_STACK = 32;
+
+    // Лента прямого прохода: значение каждой инструкции и номера инструкций-аргументов
+    struct Tape {
+        std::vector<T> values;
+        std::vector<std::array<int, 2>> args;
+        std::vector<int> roots; // инструкции, давшие выходы
+    };
+
+    Tape record(const T *values) const {
+        Tape tape{std::vector<T>(code.size()), std::vector<std::array<int, 2>>(code.size()), {}};
+        std::vector<int> stack(depth), saved(temps);
+        size_t top = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            const auto &ins = code[i];
+            auto &args = tape.args[i];
+            switch (ins.code) {
+                case PUSH_CONST: tape.values[i] = constants[ins.arg]; break;
+                case PUSH_VAR: tape.values[i] = values[ins.arg]; break;
+                case CALL_FUNC:
+                    args[0] = stack[--top];
+                    tape.values[i] = apply_function(static_cast<Function>(ins.arg), tape.values[args[0]]);
+                    break;
+                case APPLY_OP:
+                    args[1] = stack[--top];
+                    args[0] = stack[--top];
+                    tape.values[i] = apply_operation(static_cast<Operation>(ins.arg),
+                                                     tape.values[args[0]], tape.values[args[1]]);
+                    break;
+                case STORE: saved[ins.arg] = stack[top - 1]; continue;
+                case LOAD: stack[top++] = saved[ins.arg]; continue;
+            }
+            stack[top++] = static_cast<int>(i);
+        }
+        tape.roots.assign(stack.begin(), stack.begin() + outputs);
+        return tape;
+    }
+
+    // Проход назад от инструкции root: grad[slot] = d root / d слот
+    void sweep(const Tape &tape, int root, T *grad) const {
+        std::fill(grad, grad + variables.size(), T(0));
+        std::vector<T> adjoint(root + 1, T(0));
+        adjoint[root] = T(1);
+        for (size_t i = root + 1; i-- > 0;) {
+            const auto &ins = code[i];
+            const auto &args = tape.args[i];
+            const T &d = adjoint[i];
+            if (d == T(0)) continue;
+            switch (ins.code) {
+                case PUSH_VAR: grad[ins.arg] += d; break;
+                case CALL_FUNC: {
+                    const T &x = tape.values[args[0]];
+                    T derivative;
+                    switch (static_cast<Function>(ins.arg)) {
+                        case SIN: derivative = std::cos(x); break;
+                        case COS: derivative = -std::sin(x); break;
+                        case LN: derivative = T(1) / x; break;
+                        case EXP: derivative = tape.values[i]; break;
+                        default: throw std::runtime_error("Unknown function");
+                    }
+                    adjoint[args[0]] += d * derivative;
+                    break;
+                }
+                case APPLY_OP: {
+                    const T &a = tape.values[args[0]], &b = tape.values[args[1]];
+                    T &da = adjoint[args[0]], &db = adjoint[args[1]];
+                    switch (static_cast<Operation>(ins.arg)) {
+                        case PLUS: da += d; db += d; break;
+                        case MINUS: da += d; db -= d; break;
+                        case MULT: da += d * b; db += d * a; break;
+                        case DIV: da += d / b; db -= d * tape.values[i] / b; break;
+                        case POW:
+                            da += d * b * std::pow(a, b - T(1));
+                            if (code[args[1]].code != PUSH_CONST) db += d * tape.values[i] * std::log(a);
+                            break;
+                        default: throw std::runtime_error("Unknown operation");
+                    }
+                    break;
+                }
+                default: break; // константы; STORE и LOAD на ленту не попадают
+            }
+        }
+    }
+
+    static size_t chunks(size_t rows) {
+        return (rows + CHUNK - 1) / CHUNK;
+    }
+
+    static void batch_operation(Operation op, const T *a, const T *b, T *out, size_t n) {
+        if (op == DIV) {
+            bool zero = false;
+            for (size_t i = 0; i < n; ++i) zero |= b[i] == T(0);
+            if (zero) throw std::runtime_error("Division by zero");
+        }
+        if constexpr (std::is_same_v<T, double>) {
+            vector_operation(op, a, b, out, n); // вариант под текущий процессор, см. Kernels.h
+            return;
+        }
+        switch (op) {
+            case PLUS: for (size_t i = 0; i < n; ++i) out[i] = a[i] + b[i]; break;
+            case MINUS: for (size_t i = 0; i < n; ++i) out[i] = a[i] - b[i]; break;
+            case MULT: for (size_t i = 0; i < n; ++i) out[i] = a[i] * b[i]; break;
+            case DIV: for (size_t i = 0; i < n; ++i) out[i] = a[i] / b[i]; break;
+            case POW: for (size_t i = 0; i < n; ++i) out[i] = std::pow(a[i], b[i]); break;
+            default: throw std::runtime_error("Unknown operation");
+        }
+    }
+
+    static void batch_function(Function func, const T *a, T *out, size_t n) {
+        if constexpr (std::is_same_v<T, double>) {
+            vector_function(func, a, out, n); // векторные многочлены под текущий процессор, см. Kernels.h
+            return;
+        }
+        switch (func) {
+            case SIN: for (size_t i = 0; i < n; ++i) out[i] = std::sin(a[i]); break;
+            case COS: for (size_t i = 0; i < n; ++i) out[i] = std::cos(a[i]); break;
+            case LN: for (size_t i = 0; i < n; ++i) out[i] = std::log(a[i]); break;
+            case EXP: for (size_t i = 0; i < n; ++i) out[i] = std::exp(a[i]); break;
+            default: throw std::runtime_error("Unknown function");
+        }
+    }
+
+    // U - T, Dual<T> или Taylor<T>
+    template <typename U>
+    U run(const U *values) const {
+        if (depth + temps <= SMALL_STACK) {
+            std::array<U, SMALL_STACK> stack;
+            return run(values, stack.data());
+        }
+        std::vector<U> stack(depth + temps);
+        return run(values, stack.data());
+    }
+
+    // stack[0, depth) - стек, дальше временные ячейки
+    template <typename U>
+    U run(const U *values, U *stack) const {
+        U *saved = stack + depth;
+        size_t top = 0;
+        for (const auto &ins : code) {
+            switch (ins.code) {
+                case PUSH_CONST: stack[top++] = U(constants[ins.arg]); break;
+                case PUSH_VAR: stack[top++] = values[ins.arg]; break;
+                case CALL_FUNC:
+                    stack[top - 1] = apply_function(static_cast<Function>(ins.arg), stack[top - 1]);
+                    break;
+                case APPLY_OP:
+                    --top;
+                    stack[top - 1] = apply_operation(static_cast<Operation>(ins.arg), stack[top - 1], stack[top]);
+                    break;
+                case STORE: saved[ins.arg] = stack[top - 1]; break;
+                case LOAD: stack[top++] = saved[ins.arg]; break;
+            }
+        }
+        return stack[0];
+    }
+};
+
+// Переводит дерево в постфиксную программу. Узел, на который ссылаются несколько
+// родителей, вычисляется один раз, поэтому размер программы линеен по числу
+// различных узлов, а не по размеру развернутого дерева.
+template <typename T>
+class Compiler {
+    Program<T> program;
+    std::unordered_map<Symbol, int> slots;
+    std::unordered_map<const Expression<T> *, int> uses; // число ссылок на узел
+    std::unordered_map<const Expression<T> *, int> saved; // временная ячейка посчитанного узла
+    size_t top = 0; // текущая глубина стека
+
+    void emit(OpCode code, int arg) {
+        program.code.push_back({code, arg});
+        switch (code) {
+            case PUSH_CONST: case PUSH_VAR: case LOAD: top++; break;
+            case CALL_FUNC: case STORE: break;
+            case APPLY_OP: top--; break;
+        }
+        if (top > program.depth) program.depth = top;
+    }
+
+    int slot(Symbol symbol) {
+        auto it = slots.find(symbol);
+        if (it != slots.end()) return it->second;
+        int index = static_cast<int>(program.variables.size());
+        program.variables.push_back(symbol_name(symbol));
+        slots.emplace(symbol, index);
+        return index;
+    }
+
+    void count(Expression<T> *expr) { // детей узла считаем только при первой встрече
+        post_order(expr, [this](Expression<T> *node) { return uses[node]++ > 0; }, [](Expression<T> *) {});
+    }
+
+    // Обход по явному стеку: код узла выдается после кода его детей
+    void lower(Expression<T> *expr) {
+        std::vector<std::pair<Expression<T> *, size_t>> stack; // узел и номер следующего ребенка
+        auto enter = [&](Expression<T> *node) {
+            auto it = saved.find(node);
+            if (it != saved.end()) emit(LOAD, it->second);
+            else stack.emplace_back(node, 0);
+        };
+        enter(expr);
+        while (!stack.empty()) {
+            auto [node, next] = stack.back();
+            if (auto operand = node->operand(next)) {
+                ++stack.back().second;
+                enter(operand->get());
+                continue;
+            }
+            stack.pop_back();
+            emit_node(node);
+        }
+    }
+
+    void emit_node(Expression<T> *expr) {
+        if (auto constant = dynamic_cast<ConstantExpression<T> *>(expr)) {
+            program.constants.push_back(constant->value);
+            emit(PUSH_CONST, static_cast<int>(program.constants.size() - 1));
+            return;
+        } else if (auto var = dynamic_cast<VarExpression<T> *>(expr)) {
+            emit(PUSH_VAR, slot(var->symbol));
+            return;
+        } else if (auto mono = dynamic_cast<MonoExpression<T> *>(expr)) {
+            emit(CALL_FUNC, mono->func);
+        } else if (auto binary = dynamic_cast<BinaryExpression<T> *>(expr)) {
+            emit(APPLY_OP, binary->op);
+        } else {
+            throw std::runtime_error("Unknown expression");
+        }
+        if (uses[expr] > 1) { // общий узел
+            int index = static_cast<int>(program.temps++);
+            saved.emplace(expr, index);
+            emit(STORE, index);
+        }
+    }
+
+public:
+    Program<T> compile(const std::shared_ptr<Expression<T>> &expr) {
+        count(expr.get());
+        lower(expr.get());
+        return std::move(program);
+    }
+
+    // Система: выход i остается на стеке на месте i, общие узлы разных выражений считаются один раз
+    Program<T> compile(const std::vector<std::shared_ptr<Expression<T>>> &system) {
+        if (system.empty()) throw std::runtime_error("Empty system");
+        for (const auto &expr : system) count(expr.get());
+        for (const auto &expr : system) lower(expr.get());
+        program.outputs = system.size();
+        return std::move(program);
+    }
+};
+
+template <typename T>
+Program<T> compile(const std::shared_ptr<Expression<T>> &expr) {
+    return Compiler<T>().compile(expr);
+}
+
+template <typename T>
+Program<T> compile(const std::vector<std::shared_ptr<Expression<T>>> &system) {
+    return Compiler<T>().compile(system);
+}
+
+// Матрица Якоби системы по переменным names (в этом порядке) в точке values
+template <typename T>
+std::vector<T> jacobian(const std::vector<std::shared_ptr<Expression<T>>> &system, const std::vector<std::string> &names,
+                        std::span<const T> values, JacobianMode mode = AUTO_MODE) {
+    auto program = compile(system);
+    program.bind(names);
+    std::vector<T> result(system.size() * names.size());
+    program.jacobian(values, result, mode);
+    return result;
+}
+
+// Символьная матрица Якоби, собранная в одну программу: выход i * names.size() + j - d system[i] / d names[j].
+// Производные по одной переменной берутся с общим кэшем, поэтому общие части системы
+// дифференцируются и вычисляются один раз.
+template <typename T>
+Program<T> jacobian_program(const std::vector<std::shared_ptr<Expression<T>>> &system, const std::vector<std::string> &names) {
+    std::vector<std::shared_ptr<Expression<T>>> entries(system.size() * names.size());
+    for (size_t j = 0; j < names.size(); ++j) {
+        std::string var = names[j];
+        typename Expression<T>::DiffCache cache;
+        for (size_t i = 0; i < system.size(); ++i) entries[i * names.size() + j] = system[i]->diff(var, cache);
+    }
+    auto program = compile(entries);
+    program.bind(names);
+    return program;
+}
+
+// Производная выражения по var в точке parameters (прямой режим, см. Program::eval для Dual)
+template <typename T>
+T derivative(const std::shared_ptr<Expression<T>> &expr, std::map<std::string, T> &parameters, const std::string &var) {
+    return compile(expr).derivative(parameters, var);
+}
+
+// Производные выражения по var порядков 0..order (ряды Тейлора, см. Program::derivatives)
+template <typename T>
+std::vector<T> derivatives(const std::shared_ptr<Expression<T>> &expr, std::map<std::string, T> &parameters,
+                           const std::string &var, size_t order) {
+    return compile(expr).derivatives(parameters, var, order);
+}
+
+// Все частные производные выражения в точке parameters (обратный режим, см. Program::gradient)
+template <typename T>
+std::map<std::string, T> gradient(const std::shared_ptr<Expression<T>> &expr, std::map<std::string, T> &parameters) {
+    return compile(expr).gradient(parameters);
+}
+
+#endif // PROGRAM_H
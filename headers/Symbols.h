@@ -0,0 +1,20 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Глобальная таблица имен переменных: имя <-> 32-битный номер. Узлы хранят номер,
+// поэтому diff сравнивает целые числа. Номера не меняются до конца программы,
+// таблица общая для всех потоков.
+using Symbol = uint32_t;
+constexpr Symbol NO_SYMBOL = UINT32_MAX;
+
+Symbol intern_symbol(std::string_view name);   // номер имени; новое имя добавляется
+Symbol find_symbol(std::string_view name);     // NO_SYMBOL, если имени в таблице нет
+const std::string &symbol_name(Symbol symbol); // ссылка действительна до конца программы
+size_t symbol_count();
+
+#endif // SYMBOLS_H
@@ -0,0 +1,143 @@
+#ifndef TAYLOR_H
+#define TAYLOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+// Усеченный ряд Тейлора: c[n] - коэффициент при h^n. Константы хранят один
+// коэффициент, длина результата - наибольшая из длин аргументов, поэтому порядок
+// задается рядами переменных. Функции считаются рекуррентно, O(k^2) на операцию.
+// T - double или std::complex<double>.
+template <typename T>
+struct Taylor {
+    std::vector<T> c;
+
+    Taylor() = default;
+    Taylor(const T &value) : c{value} {} // константа
+    explicit Taylor(std::vector<T> coefficients) : c(std::move(coefficients)) {}
+
+    // Переменная x0 + h с рядом до order
+    static Taylor variable(const T &value, size_t order) {
+        std::vector<T> coefficients(order + 1, T(0));
+        coefficients[0] = value;
+        if (order > 0) coefficients[1] = T(1);
+        return Taylor(std::move(coefficients));
+    }
+
+    size_t size() const { return c.size(); }
+    T operator[](size_t n) const { return n < c.size() ? c[n] : T(0); }
+
+    // Сравнение по значению: деление на ряд с нулевым свободным членом - деление на ноль
+    bool operator==(const Taylor &other) const { return (*this)[0] == other[0]; }
+
+    friend Taylor operator+(const Taylor &a, const Taylor &b) {
+        std::vector<T> r(std::max(a.size(), b.size()));
+        for (size_t n = 0; n < r.size(); ++n) r[n] = a[n] + b[n];
+        return Taylor(std::move(r));
+    }
+    friend Taylor operator-(const Taylor &a, const Taylor &b) {
+        std::vector<T> r(std::max(a.size(), b.size()));
+        for (size_t n = 0; n < r.size(); ++n) r[n] = a[n] - b[n];
+        return Taylor(std::move(r));
+    }
+    friend Taylor operator*(const Taylor &a, const Taylor &b) {
+        std::vector<T> r(std::max(a.size(), b.size()), T(0));
+        for (size_t i = 0; i < a.size(); ++i) {
+            for (size_t j = 0; i + j < r.size() && j < b.size(); ++j) r[i + j] += a.c[i] * b.c[j];
+        }
+        return Taylor(std::move(r));
+    }
+    // q = a / b: a_n = sum q_j b_{n-j}
+    friend Taylor operator/(const Taylor &a, const Taylor &b) {
+        std::vector<T> q(std::max(a.size(), b.size()));
+        for (size_t n = 0; n < q.size(); ++n) {
+            T sum = a[n];
+            for (size_t j = 0; j < n; ++j) sum -= q[j] * b[n - j];
+            q[n] = sum / b[0];
+        }
+        return Taylor(std::move(q));
+    }
+
+    // e' = a' e
+    friend Taylor exp(const Taylor &a) {
+        using std::exp;
+        std::vector<T> e(a.size());
+        e[0] = exp(a[0]);
+        for (size_t n = 1; n < e.size(); ++n) {
+            T sum = T(0);
+            for (size_t j = 1; j <= n; ++j) sum += T(double(j)) * a[j] * e[n - j];
+            e[n] = sum / T(double(n));
+        }
+        return Taylor(std::move(e));
+    }
+    // a l' = a'
+    friend Taylor log(const Taylor &a) {
+        using std::log;
+        std::vector<T> l(a.size());
+        l[0] = log(a[0]);
+        for (size_t n = 1; n < l.size(); ++n) {
+            T sum = T(0);
+            for (size_t j = 1; j < n; ++j) sum += T(double(j)) * l[j] * a[n - j];
+            l[n] = (a[n] - sum / T(double(n))) / a[0];
+        }
+        return Taylor(std::move(l));
+    }
+    // s' = a' c, c' = -a' s
+    static void sincos(const Taylor &a, std::vector<T> &s, std::vector<T> &c) {
+        using std::sin, std::cos;
+        s.assign(a.size(), T(0));
+        c.assign(a.size(), T(0));
+        s[0] = sin(a[0]);
+        c[0] = cos(a[0]);
+        for (size_t n = 1; n < s.size(); ++n) {
+            T sum_s = T(0), sum_c = T(0);
+            for (size_t j = 1; j <= n; ++j) {
+                sum_s += T(double(j)) * a[j] * c[n - j];
+                sum_c += T(double(j)) * a[j] * s[n - j];
+            }
+            s[n] = sum_s / T(double(n));
+            c[n] = -sum_c / T(double(n));
+        }
+    }
+    friend Taylor sin(const Taylor &a) {
+        std::vector<T> s, c;
+        sincos(a, s, c);
+        return Taylor(std::move(s));
+    }
+    friend Taylor cos(const Taylor &a) {
+        std::vector<T> s, c;
+        sincos(a, s, c);
+        return Taylor(std::move(c));
+    }
+    // Постоянная степень: a p' = b a' p; иначе exp(b ln a).
+    // При нулевом свободном члене a целая неотрицательная степень считается умножениями.
+    friend Taylor pow(const Taylor &a, const Taylor &b) {
+        using std::pow;
+        if (b.size() > 1) return exp(b * log(a));
+        T power = b[0];
+        if (a[0] == T(0)) {
+            double whole = std::real(power);
+            if (power == T(whole) && whole >= 0 && whole <= 64) {
+                Taylor result(T(1)), base = a;
+                for (auto k = static_cast<unsigned>(whole); k > 0; k >>= 1) {
+                    if (k & 1) result = result * base;
+                    if (k > 1) base = base * base;
+                }
+                result.c.resize(std::max(a.size(), b.size()), T(0));
+                return result;
+            }
+        }
+        std::vector<T> p(a.size());
+        p[0] = pow(a[0], power);
+        for (size_t n = 1; n < p.size(); ++n) {
+            T sum = T(0);
+            for (size_t j = 1; j <= n; ++j) sum += (power * T(double(j)) - T(double(n - j))) * a[j] * p[n - j];
+            p[n] = sum / (T(double(n)) * a[0]);
+        }
+        return Taylor(std::move(p));
+    }
+};
+
+#endif // TAYLOR_H
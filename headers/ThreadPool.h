@@ -0,0 +1,45 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с перехватом задач (work stealing): у каждого потока своя очередь,
+// свои задачи он берет с конца, а освободившись - забирает чужие с начала.
+class ThreadPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues; // по одной на рабочий поток
+    std::vector<std::thread> workers;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0};
+    bool stopping = false;
+
+    bool run_one(size_t self); // своя задача или чужая; self == queues.size() - вызывающий поток
+    void work(size_t self);
+
+public:
+    // threads - общее число исполнителей вместе с вызывающим потоком; 0 - по числу ядер
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    size_t size() const { return workers.size() + 1; }
+
+    // Выполняет task(i) для всех i из [0, count) и ждет завершения.
+    // Вызывающий поток тоже берет задачи. Первое исключение из задач пробрасывается.
+    void parallel_for(size_t count, const std::function<void(size_t)> &task);
+};
+
+#endif // THREADPOOL_H
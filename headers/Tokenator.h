@@ -1,7 +1,9 @@
 #ifndef TOKENATOR_H
 #define TOKENATOR_H
+#include <optional>
 #include <vector>
 #include <string>
+#include <string_view>
 
 enum TokenType {
     NUMBER,     // Число (действительная часть)
@@ -10,18 +12,39 @@ enum TokenType {
     OPERATOR,   // Оператор (+, -, *, /, ^)
     FUNCTION,   // Функция (sin, cos, ln, exp)
     LEFT_PAREN, // Левая скобка
-    RIGHT_PAREN, // Правая скобка
-    START // для унарного минуса
+    RIGHT_PAREN // Правая скобка
 };
 
 struct Token {
     TokenType type;
-    std::string value;
+    std::string_view value; // кусок входной строки (у вставленных токенов - статическая строка)
+    int code; // Operation для OPERATOR, Function для FUNCTION, иначе 0
 
-    Token(const TokenType type, const std::string &value) noexcept
-        : type(type), value(value) {}
+    Token(const TokenType type, std::string_view value, int code = 0) noexcept
+        : type(type), value(value), code(code) {}
 };
 
-std::vector<Token> tokenize(const std::string& str);
+// Разбор на токены по требованию: next выдает очередной токен, false - конец строки.
+// Память не выделяется; токены ссылаются на input.
+class Lexer {
+    std::string_view input;
+    size_t pos = 0;
+    std::optional<TokenType> last; // тип предыдущего токена: для унарного минуса и ")i"
+    std::optional<Token> pending;  // второй из пары токенов, вставленной за один шаг
+
+    Token emit(const Token &token);
+
+public:
+    explicit Lexer(std::string_view input) : input(input) {}
+    bool next(Token &token);
+};
+
+// Токены ссылаются на str, поэтому строка должна жить, пока они используются.
+// Один проход без выделения памяти под токены; регистр имен функций не важен.
+std::vector<Token> tokenize(std::string_view str);
+std::string to_lower(std::string_view str); // имена переменных приводятся при разборе
+// Значение числового литерала (1, .5, 2.5e-3) без учета локали, точное до последнего бита.
+// nullopt - текст не число целиком (например, 1.2.3) или выходит за пределы double.
+std::optional<double> parse_number(std::string_view text);
 void printTokens(std::vector<Token> &tokens);
 #endif //TOKENATOR_H
@@ -6,11 +6,13 @@
 #include "Expression.h"
 #include "Tokenator.h"
 #include "Parser.h"
+#include "ExpressionFile.h"
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    if (argc < 3) {
      std::cerr << "Usage: differentiator --eval <expression> [variable=value ...]" << std::endl;
      std::cerr << "       differentiator --diff <expression> --by <variable>" << std::endl;
+     std::cerr << "       differentiator --file <path> [--by <variable>]" << std::endl;
      return 1;
     }
     std::string mode = argv[1];  // Режим работы (--eval или --diff)
@@ -54,8 +56,46 @@ int main(int argc, char* argv[]) {
      Parser<std::complex<double>> parser(tokens);
      auto expr = parser.parse();
      auto diffExpr = expr->diff(diffVar);
-     optimize(diffExpr);
+     diffExpr = optimize(diffExpr);
      std::cout << diffExpr->to_string() << std::endl;
+    } else if (mode == "--file") { // по выражению на строку; ошибки - в stderr с номерами строк
+     bool derive = argc > 3;
+     if (derive && (argc != 5 || std::string(argv[3]) != "--by")) {
+         std::cerr << "Usage: differentiator --file <path> [--by <variable>]" << std::endl;
+         return 1;
+     }
+     std::string diffVar = derive ? argv[4] : "";
+     ThreadPool pool;
+     ParsedLines<std::complex<double>> parsed;
+     try {
+         parsed = parse_file<std::complex<double>>(expression, pool);
+     } catch (const std::exception &error) {
+         std::cerr << error.what() << std::endl;
+         return 1;
+     }
+     std::vector<std::string> lines(parsed.expressions.size());
+     std::vector<std::string> errors(lines.size());
+     for (const auto &error : parsed.errors) errors[error.line - 1] = error.message;
+     pool.parallel_for(lines.size(), [&](size_t i) {
+         auto expr = parsed.expressions[i];
+         if (!expr) return;
+         try {
+             if (derive) expr = optimize(expr->diff(diffVar));
+             lines[i] = expr->to_string();
+         } catch (const std::exception &error) {
+             errors[i] = error.what();
+         }
+     });
+     bool failed = false;
+     for (size_t i = 0; i < lines.size(); ++i) {
+         if (errors[i].empty()) continue;
+         std::cerr << "line " << i + 1 << ": " << errors[i] << std::endl;
+         failed = true;
+     }
+     for (size_t i = 0; i < lines.size(); ++i) {
+         if (parsed.expressions[i] && errors[i].empty()) std::cout << lines[i] << '\n';
+     }
+     return failed ? 1 : 0;
     } else {
      std::cerr << "Unknown mode: " << mode << std::endl;
      return 1;
@@ -0,0 +1,52 @@
+#include "ExpressionFile.h"
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open file: " + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Cannot open file: " + path);
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length > 0) { // пустой файл отобразить нельзя
+        void *memory = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Cannot map file: " + path);
+        }
+        madvise(memory, length, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(memory);
+    }
+    close(fd); // отображение остается и без дескриптора
+}
+
+MappedFile::~MappedFile() {
+    if (data) munmap(const_cast<char *>(data), length);
+}
+
+#else
+#include <fstream>
+
+// Без POSIX - обычное чтение в память
+MappedFile::MappedFile(const std::string &path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) throw std::runtime_error("Cannot open file: " + path);
+    length = static_cast<size_t>(in.tellg());
+    char *buffer = new char[length + 1];
+    in.seekg(0);
+    in.read(buffer, static_cast<std::streamsize>(length));
+    data = buffer;
+}
+
+MappedFile::~MappedFile() {
+    delete[] data;
+}
+#endif
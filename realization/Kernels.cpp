@@ -0,0 +1,722 @@
+#include "Kernels.h"
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// Скалярный вариант: стандартная библиотека
+static void scalar_function(Function func, const double *in, double *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = apply_function(func, in[i]);
+    }
+}
+
+static void scalar_operation(Operation op, const double *left, const double *right, double *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = op == DIV ? left[i] / right[i] : apply_operation(op, left[i], right[i]);
+    }
+}
+
+static void scalar_complex_function(Function func, const double *re, const double *im,
+                                    double *out_re, double *out_im, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        auto z = apply_function(func, std::complex<double>(re[i], im[i]));
+        out_re[i] = z.real();
+        out_im[i] = z.imag();
+    }
+}
+
+static void scalar_complex_operation(Operation op, const double *left_re, const double *left_im,
+                                     const double *right_re, const double *right_im,
+                                     double *out_re, double *out_im, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        std::complex<double> a(left_re[i], left_im[i]), b(right_re[i], right_im[i]);
+        auto z = op == DIV ? a / b : apply_operation(op, a, b);
+        out_re[i] = z.real();
+        out_im[i] = z.imag();
+    }
+}
+
+static size_t scalar_span(CharClass cls, const char *text, size_t n) {
+    size_t i = 0;
+    while (i < n && char_in_class(cls, static_cast<unsigned char>(text[i]))) i++;
+    return i;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EXPRESSION_SIMD
+
+// Одна реализация на векторных расширениях GCC, собранная под SSE2 (2 значения),
+// AVX2 (4 значения) и AVX-512 (8 значений) через target-атрибуты.
+#define KERNEL static inline __attribute__((always_inline))
+
+template <int N>
+struct Lanes {
+    typedef double D __attribute__((vector_size(8 * N)));
+    typedef long long I __attribute__((vector_size(8 * N)));
+    typedef unsigned long long U __attribute__((vector_size(8 * N)));
+};
+
+static const double MAGIC = 0x1.8p52; // x + MAGIC округляет x до целого, целое - в младших битах
+static const long long MAGIC_BITS = 0x4338000000000000LL;
+
+// Округление до ближайшего целого: и как double, и как целое
+template <class D, class I>
+KERNEL void round_int(const D &x, D &rounded, I &integer) {
+    D t = x + MAGIC;
+    integer = (I) t - MAGIC_BITS;
+    rounded = t - MAGIC;
+}
+
+template <class D, class I>
+KERNEL void int_to_double(const I &integer, D &x) {
+    x = (D) (integer + MAGIC_BITS) - MAGIC;
+}
+
+// 2^k для целого k из [-1022, 1023]
+template <class D, class I>
+KERNEL void pow2(const D &k, D &x) {
+    I bits = (I) (k + MAGIC) - MAGIC_BITS;
+    x = (D) ((bits + 1023) << 52);
+}
+
+// exp: x = k ln2 + r, |r| <= ln2 / 2, e^r - ряд Тейлора до r^13
+template <class D, class I>
+KERNEL void exp_v(D &x) {
+    const double LOG2E = 1.44269504088896338700e+00;
+    const double LN2_HI = 6.93147180369123816490e-01; // 32 значащих бита: k * LN2_HI точно
+    const double LN2_LO = 1.90821492927058770002e-10;
+    const double EXP_MAX = 709.782712893383973096;
+    const double EXP_MIN = -745.133219101941108420;
+
+    D xc = x > EXP_MAX ? EXP_MAX : x;
+    xc = xc < EXP_MIN ? EXP_MIN : xc;
+    D k;
+    I ki;
+    round_int(xc * LOG2E, k, ki);
+    D r = (xc - k * LN2_HI) - k * LN2_LO;
+
+    D p = D{} + 1.0 / 6227020800.0;
+    p = 1.0 / 479001600.0 + r * p;
+    p = 1.0 / 39916800.0 + r * p;
+    p = 1.0 / 3628800.0 + r * p;
+    p = 1.0 / 362880.0 + r * p;
+    p = 1.0 / 40320.0 + r * p;
+    p = 1.0 / 5040.0 + r * p;
+    p = 1.0 / 720.0 + r * p;
+    p = 1.0 / 120.0 + r * p;
+    p = 1.0 / 24.0 + r * p;
+    p = 1.0 / 6.0 + r * p;
+    p = 0.5 + r * p;
+    p = 1.0 + r * p;
+    p = 1.0 + r * p;
+
+    // 2^k = 2^k1 * 2^k2, чтобы не выйти за диапазон показателя в крайних точках
+    D k1, k2, s1, s2;
+    I unused;
+    round_int(k * 0.5, k1, unused);
+    k2 = k - k1;
+    pow2<D, I>(k1, s1);
+    pow2<D, I>(k2, s2);
+    D y = p * s1 * s2;
+
+    y = x > EXP_MAX ? __builtin_inf() : y;
+    y = x < EXP_MIN ? 0.0 : y;
+    x = x != x ? x : y;
+}
+
+// ln: x = 2^e * m, m из [sqrt(2)/2, sqrt(2)], ln(m) = 2 atanh(f / (2 + f)), f = m - 1 (схема fdlibm)
+template <class D, class I, class U>
+KERNEL void log_v(D &x) {
+    const double LN2_HI = 6.93147180369123816490e-01;
+    const double LN2_LO = 1.90821492927058770002e-10;
+    const double SQRT2 = 1.41421356237309504880;
+    const double LG1 = 6.666666666666735130e-01, LG2 = 3.999999999940941908e-01,
+                 LG3 = 2.857142874366239149e-01, LG4 = 2.222219843214978396e-01,
+                 LG5 = 1.818357216161805012e-01, LG6 = 1.531383769920937332e-01,
+                 LG7 = 1.479819860511658591e-01;
+
+    I subnormal = x < 0x1p-1022;
+    D xs = subnormal ? x * 0x1p54 : x;
+    U bits = (U) xs;
+    I e = (I) (bits >> 52) - 1023;
+    D m = (D) ((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    D ed;
+    int_to_double<D, I>(e, ed);
+    ed = subnormal ? ed - 54.0 : ed;
+    I big = m > SQRT2;
+    m = big ? m * 0.5 : m;
+    ed = big ? ed + 1.0 : ed;
+
+    D f = m - 1.0;
+    D s = f / (2.0 + f);
+    D z = s * s;
+    D R = D{} + LG7;
+    R = LG6 + z * R;
+    R = LG5 + z * R;
+    R = LG4 + z * R;
+    R = LG3 + z * R;
+    R = LG2 + z * R;
+    R = LG1 + z * R;
+    R = z * R;
+    D hfsq = 0.5 * f * f;
+    D y = ed * LN2_HI - ((hfsq - (s * (hfsq + R) + ed * LN2_LO)) - f);
+
+    y = x == 0.0 ? -__builtin_inf() : y;
+    y = x < 0.0 ? __builtin_nan("") : y;
+    y = x == __builtin_inf() ? x : y;
+    x = x != x ? x : y;
+}
+
+// ln(1 + x) с поправкой на округление 1 + x
+template <class D, class I, class U>
+KERNEL void log1p_v(D &x) {
+    D u = 1.0 + x;
+    D correction = (x - (u - 1.0)) / u;
+    D y = u;
+    log_v<D, I, U>(y);
+    x = u == 1.0 ? x : y + correction;
+}
+
+// sin/cos: x = n pi/2 + r, |r| <= pi/4, многочлены ядра fdlibm, выбор по четверти n
+template <class D, class I>
+KERNEL void sincos_v(const D &x, D &sin_x, D &cos_x) {
+    const double INV_PIO2 = 6.36619772367581382433e-01;
+    const double PIO2_1 = 1.57079632673412561417e+00; // по 33 бита: n * PIO2_i точно при n < 2^20
+    const double PIO2_2 = 6.07710050630396597660e-11;
+    const double PIO2_3 = 2.02226624871116645580e-21;
+    const double PIO2_3T = 8.47842766036889956997e-32;
+    const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03,
+                 S3 = -1.98412698298579493134e-04, S4 = 2.75573137070700676789e-06,
+                 S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+    const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03,
+                 C3 = 2.48015872894767294178e-05, C4 = -2.75573143513906633035e-07,
+                 C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+
+    D n;
+    I ni;
+    round_int(x * INV_PIO2, n, ni);
+    D r = x - n * PIO2_1;
+    r = r - n * PIO2_2;
+    r = r - n * PIO2_3;
+    r = r - n * PIO2_3T;
+
+    D z = r * r;
+    D ps = S5 + z * S6;
+    ps = S4 + z * ps;
+    ps = S3 + z * ps;
+    ps = S2 + z * ps;
+    D sin_r = r + (z * r) * (S1 + z * ps);
+
+    D pc = C5 + z * C6;
+    pc = C4 + z * pc;
+    pc = C3 + z * pc;
+    pc = C2 + z * pc;
+    pc = C1 + z * pc;
+    D cos_r = 1.0 - (0.5 * z - z * (z * pc));
+
+    I quadrant = ni & 3;
+    D y = (quadrant & 1) != 0 ? cos_r : sin_r;
+    sin_x = (quadrant & 2) != 0 ? -y : y;
+    y = (quadrant & 1) != 0 ? sin_r : cos_r;
+    cos_x = ((quadrant + 1) & 2) != 0 ? -y : y;
+}
+
+template <int N, Function func>
+KERNEL void map_block(const double *in, double *out) {
+    typedef typename Lanes<N>::D D;
+    typedef typename Lanes<N>::I I;
+    typedef typename Lanes<N>::U U;
+    D x;
+    std::memcpy(&x, in, sizeof(x));
+    if constexpr (func == EXP) {
+        exp_v<D, I>(x);
+    } else if constexpr (func == LN) {
+        log_v<D, I, U>(x);
+    } else {
+        D arg = x, sin_x, cos_x;
+        sincos_v<D, I>(arg, sin_x, cos_x);
+        x = func == SIN ? sin_x : cos_x;
+        D mag = arg < 0.0 ? -arg : arg;
+        I slow = ~(mag < 0x1p20); // большие аргументы и inf/nan
+        for (int lane = 0; lane < N; ++lane) {
+            if (slow[lane]) x[lane] = apply_function(func, arg[lane]);
+        }
+    }
+    std::memcpy(out, &x, sizeof(x));
+}
+
+// Все значения, включая хвост, считаются одним и тем же векторным кодом:
+// результат для строки не зависит от того, в какой блок она попала
+template <int N, Function func>
+KERNEL void map_lanes(const double *in, double *out, size_t n) {
+    size_t i = 0;
+    for (; i + N <= n; i += N) {
+        map_block<N, func>(in + i, out + i);
+    }
+    if (i < n) {
+        double tail_in[N] = {}, tail_out[N];
+        std::memcpy(tail_in, in + i, (n - i) * sizeof(double));
+        map_block<N, func>(tail_in, tail_out);
+        std::memcpy(out + i, tail_out, (n - i) * sizeof(double));
+    }
+}
+
+template <int N>
+KERNEL void map_function(Function func, const double *in, double *out, size_t n) {
+    switch (func) {
+        case SIN: map_lanes<N, SIN>(in, out, n); break;
+        case COS: map_lanes<N, COS>(in, out, n); break;
+        case LN: map_lanes<N, LN>(in, out, n); break;
+        case EXP: map_lanes<N, EXP>(in, out, n); break;
+    }
+}
+
+// +, -, *, / округляются одинаково в любом варианте, хвост можно считать скалярно
+template <int N, Operation op>
+KERNEL void map_operation_lanes(const double *left, const double *right, double *out, size_t n) {
+    typedef typename Lanes<N>::D D;
+    size_t i = 0;
+    for (; i + N <= n; i += N) {
+        D a, b;
+        std::memcpy(&a, left + i, sizeof(a));
+        std::memcpy(&b, right + i, sizeof(b));
+        if constexpr (op == PLUS) a = a + b;
+        else if constexpr (op == MINUS) a = a - b;
+        else if constexpr (op == MULT) a = a * b;
+        else a = a / b;
+        std::memcpy(out + i, &a, sizeof(a));
+    }
+    scalar_operation(op, left + i, right + i, out + i, n - i);
+}
+
+template <int N>
+KERNEL void map_operation(Operation op, const double *left, const double *right, double *out, size_t n) {
+    switch (op) {
+        case PLUS: map_operation_lanes<N, PLUS>(left, right, out, n); break;
+        case MINUS: map_operation_lanes<N, MINUS>(left, right, out, n); break;
+        case MULT: map_operation_lanes<N, MULT>(left, right, out, n); break;
+        case DIV: map_operation_lanes<N, DIV>(left, right, out, n); break;
+        case POW: scalar_operation(op, left, right, out, n); break;
+    }
+}
+
+// --- Комплексные ядра: действительные и мнимые части в отдельных массивах ---
+
+// atan2(y, x): сведение к atan(t), t = min / max из [0, 1], затем к |u| <= tan(pi/8), многочлен fdlibm
+template <class D, class I, class U>
+KERNEL void atan2_v(const D &y, const D &x, D &angle) {
+    const double TAN_PI8 = 0.41421356237309504880;
+    const double PI4_HI = 7.85398163397448278999e-01, PI4_LO = 3.06161699786838301793e-17;
+    const double PI2_HI = 1.57079632679489655800e+00, PI2_LO = 6.12323399573676603587e-17;
+    const double PI_HI = 3.14159265358979311600e+00, PI_LO = 1.22464679914735317720e-16;
+    const double AT0 = 3.33333333333329318027e-01, AT1 = -1.99999999998764832476e-01,
+                 AT2 = 1.42857142725034663711e-01, AT3 = -1.11111104054623557880e-01,
+                 AT4 = 9.09088713343650656196e-02, AT5 = -7.69187620504482999495e-02,
+                 AT6 = 6.66107313738753120669e-02, AT7 = -5.83357013379057348645e-02,
+                 AT8 = 4.97687799461593236017e-02, AT9 = -3.65315727442169155270e-02,
+                 AT10 = 1.62858201153657823623e-02;
+
+    D ax = x < 0.0 ? -x : x;
+    D ay = y < 0.0 ? -y : y;
+    I swap = ay > ax;
+    D big = swap ? ay : ax;
+    D t = (swap ? ax : ay) / big;
+    t = big == 0.0 ? 0.0 : t;
+    I reduce = t > TAN_PI8;
+    D u = reduce ? (t - 1.0) / (t + 1.0) : t;
+    D z = u * u;
+    D p = D{} + AT10;
+    p = AT9 + z * p;
+    p = AT8 + z * p;
+    p = AT7 + z * p;
+    p = AT6 + z * p;
+    p = AT5 + z * p;
+    p = AT4 + z * p;
+    p = AT3 + z * p;
+    p = AT2 + z * p;
+    p = AT1 + z * p;
+    p = AT0 + z * p;
+    D a = u - u * (z * p);
+    a = reduce ? PI4_HI + (a + PI4_LO) : a;
+    a = swap ? PI2_HI - (a - PI2_LO) : a;
+    a = ((U) x >> 63) != 0 ? PI_HI - (a - PI_LO) : a; // по знаковому биту: atan2(+0, -0) = pi
+    angle = ((U) y >> 63) != 0 ? -a : a;
+}
+
+// sinh и cosh; при |x| < 1 sinh - ряд Тейлора (без потери точности на вычитании)
+template <class D, class I>
+KERNEL void sinhcosh_v(const D &x, D &sinh_x, D &cosh_x) {
+    D ax = x < 0.0 ? -x : x;
+    D e = ax;
+    exp_v<D, I>(e);
+    D inv = 1.0 / e;
+    cosh_x = 0.5 * (e + inv);
+    D big = 0.5 * (e - inv);
+    big = x < 0.0 ? -big : big;
+
+    D z = x * x;
+    D p = D{} + 1.0 / 51090942171709440000.0; // 1/21!
+    p = 1.0 / 121645100408832000.0 + z * p;
+    p = 1.0 / 355687428096000.0 + z * p;
+    p = 1.0 / 1307674368000.0 + z * p;
+    p = 1.0 / 6227020800.0 + z * p;
+    p = 1.0 / 39916800.0 + z * p;
+    p = 1.0 / 362880.0 + z * p;
+    p = 1.0 / 5040.0 + z * p;
+    p = 1.0 / 120.0 + z * p;
+    p = 1.0 / 6.0 + z * p;
+    D small = x + x * (z * p);
+    sinh_x = ax < 1.0 ? small : big;
+}
+
+template <int N, Function func>
+KERNEL void complex_block(const double *re, const double *im, double *out_re, double *out_im) {
+    typedef typename Lanes<N>::D D;
+    typedef typename Lanes<N>::I I;
+    typedef typename Lanes<N>::U U;
+    D a, b, x, y;
+    std::memcpy(&a, re, sizeof(a));
+    std::memcpy(&b, im, sizeof(b));
+    D abs_a = a < 0.0 ? -a : a;
+    D abs_b = b < 0.0 ? -b : b;
+    I slow;
+    if constexpr (func == EXP) {
+        // e^a (cos b + i sin b)
+        D ea = a, sin_b, cos_b;
+        exp_v<D, I>(ea);
+        sincos_v<D, I>(b, sin_b, cos_b);
+        x = ea * cos_b;
+        y = ea * sin_b;
+        slow = ~((abs_a < 700.0) & (abs_b < 0x1p20));
+    } else if constexpr (func == LN) {
+        // ln|z| + i arg z, m = max(|a|, |b|), k = min(|a|, |b|):
+        // ln|z| = ln m + ln(1 + t^2) / 2, t = k / m, а при m около 1 - ln(1 + (m - 1)(m + 1) + k^2) / 2
+        I swap = abs_b > abs_a;
+        D m = swap ? abs_b : abs_a;
+        D k = swap ? abs_a : abs_b;
+        D t = k / m;
+        t = m == 0.0 ? 0.0 : t;
+        I near_one = (m > 0.5) & (m < 2.0);
+        D w = near_one ? (m - 1.0) * (m + 1.0) + k * k : t * t;
+        D ln_m = near_one ? 1.0 : m, ln_w = w;
+        log_v<D, I, U>(ln_m);
+        log1p_v<D, I, U>(ln_w);
+        x = ln_m + 0.5 * ln_w;
+        atan2_v<D, I, U>(b, a, y);
+        slow = ~((abs_a <= __DBL_MAX__) & (abs_b <= __DBL_MAX__));
+    } else {
+        // sin z = sin a ch b + i cos a sh b, cos z = cos a ch b - i sin a sh b
+        D sin_a, cos_a, sinh_b, cosh_b;
+        sincos_v<D, I>(a, sin_a, cos_a);
+        sinhcosh_v<D, I>(b, sinh_b, cosh_b);
+        if constexpr (func == SIN) {
+            x = sin_a * cosh_b;
+            y = cos_a * sinh_b;
+        } else {
+            x = cos_a * cosh_b;
+            y = -(sin_a * sinh_b);
+        }
+        slow = ~((abs_a < 0x1p20) & (abs_b < 700.0));
+    }
+    for (int lane = 0; lane < N; ++lane) { // большие аргументы, inf и nan - через std::complex
+        if (slow[lane]) {
+            auto z = apply_function(func, std::complex<double>(a[lane], b[lane]));
+            x[lane] = z.real();
+            y[lane] = z.imag();
+        }
+    }
+    std::memcpy(out_re, &x, sizeof(x));
+    std::memcpy(out_im, &y, sizeof(y));
+}
+
+template <int N, Operation op>
+KERNEL void complex_operation_block(const double *left_re, const double *left_im,
+                                    const double *right_re, const double *right_im,
+                                    double *out_re, double *out_im) {
+    typedef typename Lanes<N>::D D;
+    typedef typename Lanes<N>::I I;
+    D a, b, c, d, x, y;
+    std::memcpy(&a, left_re, sizeof(a));
+    std::memcpy(&b, left_im, sizeof(b));
+    std::memcpy(&c, right_re, sizeof(c));
+    std::memcpy(&d, right_im, sizeof(d));
+    if constexpr (op == PLUS) {
+        x = a + c;
+        y = b + d;
+    } else if constexpr (op == MINUS) {
+        x = a - c;
+        y = b - d;
+    } else if constexpr (op == MULT) {
+        x = a * c - b * d;
+        y = a * d + b * c;
+    } else if constexpr (op == DIV) {
+        // алгоритм Смита: делим на большую по модулю часть знаменателя
+        D abs_c = c < 0.0 ? -c : c;
+        D abs_d = d < 0.0 ? -d : d;
+        I swap = abs_d > abs_c;
+        D p = swap ? d : c, q = swap ? c : d;
+        D r = q / p;
+        D den = p + q * r;
+        D x1 = swap ? b : a, x2 = swap ? a : b;
+        x = (x1 + x2 * r) / den;
+        y = (x2 - x1 * r) / den;
+        y = swap ? -y : y;
+    }
+    if constexpr (op == MULT || op == DIV) {
+        D all = a * 0.0 + b * 0.0 + c * 0.0 + d * 0.0; // nan, если есть inf или nan
+        I slow = all != 0.0;
+        for (int lane = 0; lane < N; ++lane) {
+            if (slow[lane]) {
+                std::complex<double> u(a[lane], b[lane]), v(c[lane], d[lane]);
+                auto z = op == MULT ? u * v : u / v;
+                x[lane] = z.real();
+                y[lane] = z.imag();
+            }
+        }
+    }
+    std::memcpy(out_re, &x, sizeof(x));
+    std::memcpy(out_im, &y, sizeof(y));
+}
+
+template <int N, Function func>
+KERNEL void complex_lanes(const double *re, const double *im, double *out_re, double *out_im, size_t n) {
+    size_t i = 0;
+    for (; i + N <= n; i += N) {
+        complex_block<N, func>(re + i, im + i, out_re + i, out_im + i);
+    }
+    if (i < n) {
+        double tail_re[N] = {}, tail_im[N] = {}, tail_out_re[N], tail_out_im[N];
+        std::memcpy(tail_re, re + i, (n - i) * sizeof(double));
+        std::memcpy(tail_im, im + i, (n - i) * sizeof(double));
+        complex_block<N, func>(tail_re, tail_im, tail_out_re, tail_out_im);
+        std::memcpy(out_re + i, tail_out_re, (n - i) * sizeof(double));
+        std::memcpy(out_im + i, tail_out_im, (n - i) * sizeof(double));
+    }
+}
+
+template <int N>
+KERNEL void map_complex_function(Function func, const double *re, const double *im,
+                                 double *out_re, double *out_im, size_t n) {
+    switch (func) {
+        case SIN: complex_lanes<N, SIN>(re, im, out_re, out_im, n); break;
+        case COS: complex_lanes<N, COS>(re, im, out_re, out_im, n); break;
+        case LN: complex_lanes<N, LN>(re, im, out_re, out_im, n); break;
+        case EXP: complex_lanes<N, EXP>(re, im, out_re, out_im, n); break;
+    }
+}
+
+template <int N, Operation op>
+KERNEL void complex_operation_lanes(const double *left_re, const double *left_im,
+                                    const double *right_re, const double *right_im,
+                                    double *out_re, double *out_im, size_t n) {
+    size_t i = 0;
+    for (; i + N <= n; i += N) {
+        complex_operation_block<N, op>(left_re + i, left_im + i, right_re + i, right_im + i, out_re + i, out_im + i);
+    }
+    if (i < n) {
+        double tail[4][N] = {}, tail_out_re[N], tail_out_im[N];
+        std::memcpy(tail[0], left_re + i, (n - i) * sizeof(double));
+        std::memcpy(tail[1], left_im + i, (n - i) * sizeof(double));
+        std::memcpy(tail[2], right_re + i, (n - i) * sizeof(double));
+        std::memcpy(tail[3], right_im + i, (n - i) * sizeof(double));
+        complex_operation_block<N, op>(tail[0], tail[1], tail[2], tail[3], tail_out_re, tail_out_im);
+        std::memcpy(out_re + i, tail_out_re, (n - i) * sizeof(double));
+        std::memcpy(out_im + i, tail_out_im, (n - i) * sizeof(double));
+    }
+}
+
+template <int N>
+KERNEL void map_complex_operation(Operation op, const double *left_re, const double *left_im,
+                                  const double *right_re, const double *right_im,
+                                  double *out_re, double *out_im, size_t n) {
+    switch (op) {
+        case PLUS: complex_operation_lanes<N, PLUS>(left_re, left_im, right_re, right_im, out_re, out_im, n); break;
+        case MINUS: complex_operation_lanes<N, MINUS>(left_re, left_im, right_re, right_im, out_re, out_im, n); break;
+        case MULT: complex_operation_lanes<N, MULT>(left_re, left_im, right_re, right_im, out_re, out_im, n); break;
+        case DIV: complex_operation_lanes<N, DIV>(left_re, left_im, right_re, right_im, out_re, out_im, n); break;
+        case POW: scalar_complex_operation(op, left_re, left_im, right_re, right_im, out_re, out_im, n); break;
+    }
+}
+
+// Классы символов для N байт сразу; хвост короче N - скалярно
+template <int N>
+KERNEL size_t map_span(CharClass cls, const char *text, size_t n) {
+    typedef unsigned char U __attribute__((vector_size(N)));
+    size_t i = 0;
+    for (; i + N <= n; i += N) {
+        U c;
+        std::memcpy(&c, text + i, N);
+        U hit; // 0xff - символ из класса
+        switch (cls) {
+            case SPACE_CHARS: hit = (U)((c == ' ') | (c - '\t' <= '\r' - '\t')); break;
+            case DIGIT_CHARS: hit = (U)(c - '0' <= 9); break;
+            case NUMBER_CHARS: hit = (U)((c - '0' <= 9) | (c == '.')); break;
+            case ALPHA_CHARS: hit = (U)((c | 0x20) - 'a' <= 'z' - 'a'); break;
+            default: return i + scalar_span(cls, text + i, n - i);
+        }
+        unsigned long long words[N / 8];
+        std::memcpy(words, &hit, N);
+        for (int w = 0; w < N / 8; ++w) {
+            if (~words[w]) return i + w * 8 + __builtin_ctzll(~words[w]) / 8; // первый байт вне класса
+        }
+    }
+    return i + scalar_span(cls, text + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void sse2_function(Function func, const double *in, double *out, size_t n) {
+    map_function<2>(func, in, out, n);
+}
+
+__attribute__((target("sse2")))
+static void sse2_operation(Operation op, const double *left, const double *right, double *out, size_t n) {
+    map_operation<2>(op, left, right, out, n);
+}
+
+__attribute__((target("sse2")))
+static void sse2_complex_function(Function func, const double *re, const double *im,
+                               double *out_re, double *out_im, size_t n) {
+    map_complex_function<2>(func, re, im, out_re, out_im, n);
+}
+
+__attribute__((target("sse2")))
+static void sse2_complex_operation(Operation op, const double *left_re, const double *left_im,
+                                const double *right_re, const double *right_im,
+                                double *out_re, double *out_im, size_t n) {
+    map_complex_operation<2>(op, left_re, left_im, right_re, right_im, out_re, out_im, n);
+}
+
+__attribute__((target("sse2")))
+static size_t sse2_span(CharClass cls, const char *text, size_t n) {
+    return map_span<16>(cls, text, n);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_function(Function func, const double *in, double *out, size_t n) {
+    map_function<4>(func, in, out, n);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_operation(Operation op, const double *left, const double *right, double *out, size_t n) {
+    map_operation<4>(op, left, right, out, n);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_complex_function(Function func, const double *re, const double *im,
+                               double *out_re, double *out_im, size_t n) {
+    map_complex_function<4>(func, re, im, out_re, out_im, n);
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_complex_operation(Operation op, const double *left_re, const double *left_im,
+                                const double *right_re, const double *right_im,
+                                double *out_re, double *out_im, size_t n) {
+    map_complex_operation<4>(op, left_re, left_im, right_re, right_im, out_re, out_im, n);
+}
+
+__attribute__((target("avx2,fma")))
+static size_t avx2_span(CharClass cls, const char *text, size_t n) {
+    return map_span<32>(cls, text, n);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_function(Function func, const double *in, double *out, size_t n) {
+    map_function<8>(func, in, out, n);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_operation(Operation op, const double *left, const double *right, double *out, size_t n) {
+    map_operation<8>(op, left, right, out, n);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_complex_function(Function func, const double *re, const double *im,
+                               double *out_re, double *out_im, size_t n) {
+    map_complex_function<8>(func, re, im, out_re, out_im, n);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_complex_operation(Operation op, const double *left_re, const double *left_im,
+                                const double *right_re, const double *right_im,
+                                double *out_re, double *out_im, size_t n) {
+    map_complex_operation<8>(op, left_re, left_im, right_re, right_im, out_re, out_im, n);
+}
+#endif
+
+static const KernelTable TABLES[] = {
+    {SCALAR_KERNELS, scalar_function, scalar_operation, scalar_complex_function, scalar_complex_operation,
+     scalar_span},
+#ifdef EXPRESSION_SIMD
+    {SSE2_KERNELS, sse2_function, sse2_operation, sse2_complex_function, sse2_complex_operation, sse2_span},
+    {AVX2_KERNELS, avx2_function, avx2_operation, avx2_complex_function, avx2_complex_operation, avx2_span},
+    {AVX512_KERNELS, avx512_function, avx512_operation, avx512_complex_function, avx512_complex_operation,
+     avx2_span}, // байтовые сравнения AVX-512F не дает
+#endif
+};
+
+KernelSet supported_kernel_set() {
+#ifdef EXPRESSION_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return AVX512_KERNELS;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return AVX2_KERNELS;
+    if (__builtin_cpu_supports("sse2")) return SSE2_KERNELS;
+#endif
+    return SCALAR_KERNELS;
+}
+
+std::string kernel_set_name(KernelSet set) {
+    switch (set) {
+        case SCALAR_KERNELS: return "scalar";
+        case SSE2_KERNELS: return "sse2";
+        case AVX2_KERNELS: return "avx2";
+        case AVX512_KERNELS: return "avx512";
+        default: return "unknown";
+    }
+}
+
+const KernelTable &kernel_table(KernelSet set) {
+    if (set > supported_kernel_set()) {
+        throw std::runtime_error("Kernel set is not supported: " + kernel_set_name(set));
+    }
+    return TABLES[set];
+}
+
+static KernelSet choose_kernel_set() {
+    KernelSet set = supported_kernel_set();
+    if (const char *forced = std::getenv("EXPRESSION_KERNELS")) {
+        for (KernelSet lower : {SCALAR_KERNELS, SSE2_KERNELS, AVX2_KERNELS, AVX512_KERNELS}) {
+            if (kernel_set_name(lower) == forced && lower < set) set = lower; // только понижение
+        }
+    }
+    return set;
+}
+
+const KernelTable &active_kernels() {
+    static const KernelTable &table = kernel_table(choose_kernel_set()); // один раз за запуск
+    return table;
+}
+
+void vector_function(Function func, const double *in, double *out, size_t n) {
+    active_kernels().function(func, in, out, n);
+}
+
+void vector_operation(Operation op, const double *left, const double *right, double *out, size_t n) {
+    active_kernels().operation(op, left, right, out, n);
+}
+
+void vector_complex_function(Function func, const double *re, const double *im,
+                             double *out_re, double *out_im, size_t n) {
+    active_kernels().complex_function(func, re, im, out_re, out_im, n);
+}
+
+void vector_complex_operation(Operation op, const double *left_re, const double *left_im,
+                              const double *right_re, const double *right_im,
+                              double *out_re, double *out_im, size_t n) {
+    active_kernels().complex_operation(op, left_re, left_im, right_re, right_im, out_re, out_im, n);
+}
+
+size_t char_span(CharClass cls, const char *text, size_t n) {
+    return active_kernels().span(cls, text, n);
+}
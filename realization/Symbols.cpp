@@ -0,0 +1,56 @@
+#include "Symbols.h"
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+struct NameHash {
+    using is_transparent = void; // поиск по string_view без создания строки
+    size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+};
+
+struct SymbolTable {
+    std::shared_mutex mutex;
+    std::deque<std::string> names; // адреса строк не меняются при добавлении
+    std::unordered_map<std::string, Symbol, NameHash, std::equal_to<>> symbols;
+};
+
+SymbolTable &table() {
+    static SymbolTable instance;
+    return instance;
+}
+
+} // namespace
+
+Symbol find_symbol(std::string_view name) {
+    auto &t = table();
+    std::shared_lock<std::shared_mutex> lock(t.mutex);
+    auto it = t.symbols.find(name);
+    return it == t.symbols.end() ? NO_SYMBOL : it->second;
+}
+
+Symbol intern_symbol(std::string_view name) {
+    Symbol symbol = find_symbol(name);
+    if (symbol != NO_SYMBOL) return symbol;
+    auto &t = table();
+    std::unique_lock<std::shared_mutex> lock(t.mutex);
+    auto [it, inserted] = t.symbols.try_emplace(std::string(name), static_cast<Symbol>(t.names.size()));
+    if (inserted) t.names.emplace_back(name);
+    return it->second;
+}
+
+const std::string &symbol_name(Symbol symbol) {
+    auto &t = table();
+    std::shared_lock<std::shared_mutex> lock(t.mutex);
+    if (symbol >= t.names.size()) throw std::runtime_error("Unknown symbol: " + std::to_string(symbol));
+    return t.names[symbol];
+}
+
+size_t symbol_count() {
+    auto &t = table();
+    std::shared_lock<std::shared_mutex> lock(t.mutex);
+    return t.names.size();
+}
@@ -0,0 +1,104 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <exception>
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i + 1 < threads; ++i) {
+        queues.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i + 1 < threads; ++i) {
+        workers.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+bool ThreadPool::run_one(size_t self) {
+    std::function<void()> task;
+    if (self < queues.size()) { // своя очередь - с конца
+        std::lock_guard<std::mutex> lock(queues[self]->mutex);
+        if (!queues[self]->tasks.empty()) {
+            task = std::move(queues[self]->tasks.back());
+            queues[self]->tasks.pop_back();
+        }
+    }
+    for (size_t i = 1; !task && i <= queues.size(); ++i) { // чужие - с начала
+        auto &victim = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+    if (!task) return false;
+    queued--;
+    task();
+    return true;
+}
+
+void ThreadPool::work(size_t self) {
+    while (true) {
+        if (run_one(self)) continue;
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping) return;
+    }
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)> &task) {
+    if (count == 0) return;
+    if (queues.empty()) {
+        for (size_t i = 0; i < count; ++i) task(i);
+        return;
+    }
+
+    struct State {
+        size_t remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    } state;
+    state.remaining = count;
+
+    auto run = [&state, &task](size_t i) {
+        try {
+            task(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.error) state.error = std::current_exception();
+        }
+        // после снятия блокировки задача state больше не трогает
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (--state.remaining == 0) state.done.notify_all();
+    };
+
+    // Каждому потоку - непрерывный диапазон индексов
+    for (size_t w = 0; w < queues.size(); ++w) {
+        size_t begin = count * w / queues.size(), end = count * (w + 1) / queues.size();
+        std::lock_guard<std::mutex> lock(queues[w]->mutex);
+        for (size_t i = end; i > begin; --i) { // с конца берется первый индекс диапазона
+            queues[w]->tasks.emplace_back([run, i] { run(i - 1); });
+        }
+        queued += end - begin;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+    }
+    wake.notify_all();
+
+    while (run_one(queues.size())) {
+    }
+    std::unique_lock<std::mutex> lock(state.mutex); // остались только выполняющиеся задачи
+    state.done.wait(lock, [&state] { return state.remaining == 0; });
+    if (state.error) std::rethrow_exception(state.error);
+}
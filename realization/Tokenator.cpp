@@ -1,92 +1,132 @@
 #include "Tokenator.h"
+#include "Expression.h"
+#include "Kernels.h"
+#include <charconv>
 #include <iostream>
 
-std::string lower(const std::string& str) {
+// Только ASCII и без учета локали, как и классы символов лексера (Kernels.h)
+std::string to_lower(std::string_view str) {
     std::string res(str);
     for (char& c : res) {
-        c = static_cast<char>(std::tolower(c));
+        if (c >= 'A' && c <= 'Z') c |= 0x20;
     }
     return res;
 }
 
-std::vector<Token> tokenize(const std::string &input_) {
-    auto input = '#' + input_;
-    std::vector<Token> tokens;
-    size_t i = 0;
+// Сравнение без учета регистра с name в нижнем регистре
+static bool equals_lower(std::string_view str, std::string_view name) {
+    if (str.size() != name.size()) return false;
+    for (size_t i = 0; i < str.size(); ++i) {
+        if ((str[i] | 0x20) != name[i]) return false; // str - только ASCII-буквы
+    }
+    return true;
+}
 
-    while (i < input.size()) {
-        char c = input[i];
+// Длина отрезка символов класса cls начиная с pos. Короткие отрезки (обычные в выражениях)
+// проверяются на месте, векторное ядро вызывается только для длинных.
+static size_t span(std::string_view input, size_t pos, CharClass cls) {
+    static const auto scan = active_kernels().span;
+    size_t end = pos, limit = std::min(input.size(), pos + 16);
+    while (end < limit && char_in_class(cls, static_cast<unsigned char>(input[end]))) end++;
+    if (end < limit || end == input.size()) return end - pos;
+    return end - pos + scan(cls, input.data() + end, input.size() - end);
+}
 
-        if (std::isspace(c)) {
-            i++;
-            continue;
-        }
-        if (c == '#') {
-            tokens.emplace_back(START, "#");
-            i++;
-            continue;
+Token Lexer::emit(const Token &token) {
+    last = token.type;
+    return token;
+}
+
+bool Lexer::next(Token &token) {
+    if (pending) {
+        token = emit(*pending);
+        pending.reset();
+        return true;
+    }
+    pos += span(input, pos, SPACE_CHARS);
+    if (pos == input.size()) return false;
+    auto c = static_cast<unsigned char>(input[pos]);
+
+    if (char_in_class(NUMBER_CHARS, c)) {
+        size_t start = pos;
+        pos += span(input, pos, NUMBER_CHARS);
+        // Порядок: e или E, затем необязательный знак и цифры (иначе e - начало имени)
+        if (pos < input.size() && (input[pos] == 'e' || input[pos] == 'E')) {
+            size_t digits = pos + 1;
+            if (digits < input.size() && (input[digits] == '+' || input[digits] == '-')) digits++;
+            size_t length = span(input, digits, DIGIT_CHARS);
+            if (length > 0) pos = digits + length;
         }
-        if (isdigit(c) || c == '.') {
-            std::string numStr;
-            while (i < input.size() && (std::isdigit(input[i]) || input[i] == '.')) {
-                numStr += input[i];
-                i++;
-            }
-            tokens.emplace_back(NUMBER, numStr);
-            continue;
+        auto number = input.substr(start, pos - start);
+        // 'i' после числа (в том числе через пробелы) делает его мнимым
+        size_t after = pos + span(input, pos, SPACE_CHARS);
+        if (after < input.size() && input[after] == 'i') {
+            pos = after + 1;
+            token = emit(Token(COMPLEX, number));
+        } else {
+            token = emit(Token(NUMBER, number));
         }
+        return true;
+    }
 
-        if (c == 'i') {
-            if (!tokens.empty() && tokens.back().type == NUMBER) {
-                tokens.back().type = COMPLEX;
-            } else {
-                if (!tokens.empty() && tokens.back().type == RIGHT_PAREN)
-                    tokens.emplace_back(OPERATOR, "*");
-                tokens.emplace_back(COMPLEX, "1");
-            }
-            i++;
-            continue;
+    if (c == 'i') {
+        pos++;
+        if (last == RIGHT_PAREN) {
+            pending = Token(COMPLEX, "1");
+            token = emit(Token(OPERATOR, "*", MULT));
+        } else {
+            token = emit(Token(COMPLEX, "1"));
         }
+        return true;
+    }
 
-        if (std::isalpha(c)) {
-            std::string name;
-            while (i < input.size() && std::isalpha(input[i])) {
-                name += input[i];
-                i++;
-            }
-            name = lower(name);
-            if (name == "sin" || name == "cos" || name == "ln" || name == "exp") {
-                tokens.emplace_back(FUNCTION, name);
-            } else {
-                tokens.emplace_back(VARIABLE, name);
-            }
-            continue;
-        }
+    if (char_in_class(ALPHA_CHARS, c)) {
+        size_t start = pos;
+        pos += span(input, pos, ALPHA_CHARS);
+        auto name = input.substr(start, pos - start);
+        if (equals_lower(name, "sin")) token = emit(Token(FUNCTION, name, SIN));
+        else if (equals_lower(name, "cos")) token = emit(Token(FUNCTION, name, COS));
+        else if (equals_lower(name, "ln")) token = emit(Token(FUNCTION, name, LN));
+        else if (equals_lower(name, "exp")) token = emit(Token(FUNCTION, name, EXP));
+        else token = emit(Token(VARIABLE, name));
+        return true;
+    }
 
-        if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^') {
-            if (c == '-') {
-                if (!tokens.empty() && (tokens.back().type == LEFT_PAREN || tokens.back().type == START)) {
-                    tokens.emplace_back(NUMBER, "0");
-                }
-            }
-            tokens.emplace_back(OPERATOR, std::string(1, c));
-            i++;
-            continue;
+    if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^') {
+        Operation op = c == '+' ? PLUS : c == '-' ? MINUS : c == '*' ? MULT : c == '/' ? DIV : POW;
+        Token operation(OPERATOR, input.substr(pos, 1), op);
+        pos++;
+        if (c == '-' && (!last || last == LEFT_PAREN)) { // унарный минус: 0 - ...
+            pending = operation;
+            token = emit(Token(NUMBER, "0"));
+        } else {
+            token = emit(operation);
         }
+        return true;
+    }
 
-        if (c == '(') {
-            tokens.emplace_back(LEFT_PAREN, "(");
-            i++;
-            continue;
-        }
-        if (c == ')') {
-            tokens.emplace_back(RIGHT_PAREN, ")");
-            i++;
-            continue;
-        }
-        throw std::runtime_error("Unknown character: " + std::string(1, c));
+    if (c == '(' || c == ')') {
+        token = emit(Token(c == '(' ? LEFT_PAREN : RIGHT_PAREN, input.substr(pos, 1)));
+        pos++;
+        return true;
+    }
+    throw std::runtime_error("Unknown character: " + std::string(1, static_cast<char>(c)));
+}
+
+std::optional<double> parse_number(std::string_view text) {
+    double value;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end != text.data() + text.size()) return std::nullopt;
+    return value;
+}
+
+std::vector<Token> tokenize(std::string_view input) {
+    std::vector<Token> tokens;
+    Lexer lexer(input);
+    Token token(NUMBER, "");
+    while (lexer.next(token)) {
+        tokens.push_back(token);
     }
-    tokens.erase(tokens.begin());
     return tokens;
 }
 
@@ -100,7 +140,6 @@ void printTokens(std::vector<Token> &tokens) {
             case OPERATOR: std::cout << "OPERATOR: " << token.value << std::endl; break;
             case LEFT_PAREN: std::cout << "LEFT_P: (" << std::endl; break;
             case RIGHT_PAREN: std::cout << "RIGHT_P: )" << std::endl; break;
-            case START: std::cout << "START: " << token.value << std::endl; break; // добавкой
         }
     }
 }
\ No newline at end of file
@@ -2,6 +2,13 @@
 #include "Expression.h"
 #include "Tokenator.h"
 #include "Parser.h"
+#include "Program.h"
+#include "FlatExpression.h"
+#include "ExpressionCache.h"
+#include "ExpressionFile.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 
 bool diff_double(const std::string &input, const std::string &expected, std::string by) {
     auto tokens = tokenize(input);
@@ -191,4 +198,948 @@ TEST_CASE("Распознание") {
         CHECK(scan_complex("exp(a * b)", "exp(a * b)"));
         CHECK(scan_complex("(1.2 + sin(3.4)) * i", "((1.200000 + sin(3.400000)) * 1i)"));
     }
-}
\ No newline at end of file
+}
+
+template <typename T>
+bool compile_eval(const std::string &input, const std::map<std::string, T> &params) {
+    auto tokens = tokenize(input);
+    Parser<T> parser(tokens);
+    auto expr = parser.parse();
+    auto program = compile(expr);
+    auto tree_params = params;
+    auto program_params = params;
+    auto expected = expr->eval(tree_params);
+    auto result = program.eval(program_params);
+    std::cout << input << " = " << result << " || " << expected << " (tree)" << std::endl;
+    return result == expected;
+}
+
+TEST_CASE("Компиляция") {
+    SECTION("DOUBLE") {
+        CHECK(compile_eval<double>("x + y * z", {{"x", 1}, {"y", 2}, {"z", 3}}));
+        CHECK(compile_eval<double>("(a + b) * (c - d) / e", {{"a", 6}, {"b", 2}, {"c", 10}, {"d", 4}, {"e", 4}}));
+        CHECK(compile_eval<double>("sin(x) * cos(x) + ln(x) - exp(x)", {{"x", 0.7}}));
+        CHECK(compile_eval<double>("x ^ y ^ 2 - x / y", {{"x", 1.5}, {"y", 2.5}}));
+        CHECK(compile_eval<double>("-x + 3.25", {{"x", 2}}));
+        CHECK(compile_eval<double>("x + q", {{"x", 2}})); // отсутствующая переменная = 0
+        auto program = compile(Parser<double>(tokenize("x * x + x")).parse());
+        CHECK(program.variables.size() == 1);
+        CHECK(program.code.size() == 5);
+        std::map<std::string, double> params{{"x", 1}};
+        CHECK_THROWS(compile(Parser<double>(tokenize("x / (x - 1)")).parse()).eval(params));
+    }
+    SECTION("COMPLEX") {
+        CHECK(compile_eval<std::complex<double>>("x * y * i", {{"x", to_cm(2, 1)}, {"y", to_cm(1, 2)}}));
+        CHECK(compile_eval<std::complex<double>>("(x + y) ^ (a - b)",
+              {{"x", to_cm(1, 1)}, {"y", to_cm(1, 2)}, {"a", to_cm(2, 0)}, {"b", to_cm(1, 1)}}));
+        CHECK(compile_eval<std::complex<double>>("exp(i * x) * sin(x) / ln(x + 2)", {{"x", to_cm(0.3, -1)}}));
+    }
+}
+
+TEST_CASE("Привязка переменных") {
+    auto expr = Parser<double>(tokenize("x * y - z / x")).parse();
+    auto program = compile(expr);
+    program.bind({"z", "y", "x", "unused"});
+    std::vector<double> values{3, 5, 2, 100};
+    std::map<std::string, double> params{{"x", 2}, {"y", 5}, {"z", 3}};
+    CHECK(program.eval(std::span<const double>(values)) == expr->eval(params));
+    CHECK(program.variables.size() == 4);
+    CHECK_THROWS(program.eval(std::span<const double>(values.data(), 2)));
+
+    auto unbound = compile(expr);
+    CHECK_THROWS_WITH(unbound.bind({"x", "y"}), "Unbound variable: z");
+
+    auto complex_program = compile(Parser<std::complex<double>>(tokenize("a * i + b")).parse());
+    complex_program.bind({"b", "a"});
+    std::vector<std::complex<double>> complex_values{to_cm(1, 1), to_cm(2, 0)};
+    CHECK(complex_program.eval(std::span<const std::complex<double>>(complex_values)) == to_cm(1, 3));
+}
+
+template <typename T>
+bool batch_eval(const std::string &input, const std::vector<std::string> &names, const std::vector<std::vector<T>> &columns) {
+    auto expr = Parser<T>(tokenize(input)).parse();
+    auto program = compile(expr);
+    program.bind(names);
+    std::vector<std::span<const T>> spans(columns.begin(), columns.end());
+    std::vector<T> out(columns.empty() ? 0 : columns[0].size());
+    program.eval_batch(spans, out);
+    for (size_t row = 0; row < out.size(); ++row) {
+        std::map<std::string, T> params;
+        for (size_t slot = 0; slot < names.size(); ++slot) params[names[slot]] = columns[slot][row];
+        auto expected = expr->eval(params);
+        if (std::abs(out[row] - expected) > 1e-13 * std::max(1.0, std::abs(expected))) { // векторные sin/cos/ln/exp - до 2.5 ULP
+            std::cout << input << " row " << row << ": " << out[row] << " || " << expected << " (tree)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("Пакетный подсчет") {
+    const size_t rows = 3 * Program<double>::BLOCK + 17; // несколько блоков и хвост
+    std::vector<double> x(rows), y(rows);
+    std::vector<std::complex<double>> zx(rows), zy(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        x[i] = 0.001 * static_cast<double>(i) + 0.5;
+        y[i] = 2.0 - 0.0005 * static_cast<double>(i);
+        zx[i] = to_cm(x[i], y[i]);
+        zy[i] = to_cm(y[i], -x[i]);
+    }
+    SECTION("DOUBLE") {
+        CHECK(batch_eval<double>("x + y * 2 - x / y", {"x", "y"}, {x, y}));
+        CHECK(batch_eval<double>("(x - 1) * (y + 3) ^ 2", {"x", "y"}, {x, y}));
+        CHECK(batch_eval<double>("sin(x) + cos(y) - ln(x) * exp(y)", {"x", "y"}, {x, y}));
+        CHECK(batch_eval<double>("3 * 4", {}, {}));
+        CHECK_THROWS(batch_eval<double>("x / (y - y)", {"x", "y"}, {x, y}));
+    }
+    SECTION("COMPLEX") {
+        CHECK(batch_eval<std::complex<double>>("x * y * i - x / y", {"x", "y"}, {zx, zy}));
+        CHECK(batch_eval<std::complex<double>>("exp(x) + ln(y) * sin(x) - cos(y) ^ x", {"x", "y"}, {zx, zy}));
+    }
+}
+
+TEST_CASE("Векторные функции") {
+    std::vector<double> in;
+    for (int i = -2000; i <= 2000; ++i) in.push_back(i * 0.37);
+    std::vector<double> positive;
+    for (int i = 1; i <= 4000; ++i) positive.push_back(std::ldexp(1.0 + i / 4000.0, i / 4 - 500));
+    auto check = [](Function func, const std::vector<double> &values) {
+        std::vector<double> out(values.size());
+        vector_function(func, values.data(), out.data(), values.size());
+        for (size_t i = 0; i < values.size(); ++i) {
+            double expected = apply_function(func, values[i]);
+            if (std::abs(out[i] - expected) > 4 * std::numeric_limits<double>::epsilon() * std::abs(expected)
+                && std::abs(out[i] - expected) > 1e-300) {
+                std::cout << "func " << func << "(" << values[i] << ") = " << out[i] << " || " << expected << std::endl;
+                return false;
+            }
+        }
+        return true;
+    };
+    CHECK(check(SIN, in));
+    CHECK(check(COS, in));
+    CHECK(check(EXP, in));
+    CHECK(check(LN, positive));
+    CHECK(check(SIN, {1e7, -3e300}));
+
+    std::vector<double> special{0.0, -1.0, INFINITY, -INFINITY, NAN, 5e-324, 710, -746};
+    for (Function func : {SIN, COS, LN, EXP}) {
+        std::vector<double> out(special.size());
+        vector_function(func, special.data(), out.data(), special.size());
+        for (size_t i = 0; i < special.size(); ++i) {
+            double expected = apply_function(func, special[i]);
+            if (std::isnan(expected)) CHECK(std::isnan(out[i]));
+            else if (std::isinf(expected) || expected == 0) CHECK(out[i] == expected);
+        }
+    }
+}
+
+TEST_CASE("Выбор ядер") {
+    CHECK(active_kernels().set <= supported_kernel_set());
+    CHECK(kernel_set_name(active_kernels().set) != "unknown");
+    std::cout << "kernels: " << kernel_set_name(active_kernels().set)
+              << " (supported: " << kernel_set_name(supported_kernel_set()) << ")" << std::endl;
+    if (supported_kernel_set() < AVX512_KERNELS) CHECK_THROWS(kernel_table(AVX512_KERNELS));
+
+    std::vector<double> a, b;
+    for (int i = 0; i < 1003; ++i) {
+        a.push_back(0.01 * i - 3.0);
+        b.push_back(1.5 + 0.003 * i);
+    }
+    const auto &scalar = kernel_table(SCALAR_KERNELS);
+    for (int level = SSE2_KERNELS; level <= supported_kernel_set(); ++level) {
+        const auto &table = kernel_table(static_cast<KernelSet>(level));
+        CHECK(table.set == level);
+        for (Operation op : {PLUS, MINUS, MULT, DIV, POW}) {
+            std::vector<double> expected(a.size()), out(a.size());
+            scalar.operation(op, a.data(), b.data(), expected.data(), a.size());
+            table.operation(op, a.data(), b.data(), out.data(), a.size());
+            // арифметика округляется одинаково на всех уровнях (побайтно, включая nan)
+            CHECK(std::memcmp(out.data(), expected.data(), out.size() * sizeof(double)) == 0);
+        }
+        for (Function func : {SIN, COS, EXP}) {
+            std::vector<double> expected(a.size()), out(a.size());
+            scalar.function(func, a.data(), expected.data(), a.size());
+            table.function(func, a.data(), out.data(), a.size());
+            bool close = true;
+            for (size_t i = 0; i < a.size(); ++i) {
+                close &= std::abs(out[i] - expected[i]) <= 4 * std::numeric_limits<double>::epsilon() * std::abs(expected[i]);
+            }
+            CHECK(close);
+        }
+    }
+}
+
+bool batch_split(const std::string &input, const std::vector<std::string> &names,
+                 const std::vector<std::vector<double>> &re, const std::vector<std::vector<double>> &im) {
+    auto expr = Parser<std::complex<double>>(tokenize(input)).parse();
+    auto program = compile(expr);
+    program.bind(names);
+    std::vector<std::span<const double>> re_spans(re.begin(), re.end()), im_spans(im.begin(), im.end());
+    std::vector<double> out_re(re[0].size()), out_im(re[0].size());
+    program.eval_batch(re_spans, im_spans, out_re, out_im);
+    for (size_t row = 0; row < out_re.size(); ++row) {
+        std::map<std::string, std::complex<double>> params;
+        for (size_t slot = 0; slot < names.size(); ++slot) params[names[slot]] = to_cm(re[slot][row], im[slot][row]);
+        auto expected = expr->eval(params);
+        if (std::abs(to_cm(out_re[row], out_im[row]) - expected) > 1e-13 * std::max(1.0, std::abs(expected))) {
+            std::cout << input << " row " << row << ": " << to_cm(out_re[row], out_im[row]) << " || " << expected << " (tree)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST_CASE("Комплексный пакетный подсчет") {
+    const size_t rows = 2 * Program<double>::BLOCK + 5;
+    std::vector<double> xr(rows), xi(rows), yr(rows), yi(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        xr[i] = 0.002 * static_cast<double>(i) - 1.7;
+        xi[i] = 1.3 - 0.001 * static_cast<double>(i);
+        yr[i] = 0.5 + 0.0007 * static_cast<double>(i);
+        yi[i] = -0.9 + 0.0011 * static_cast<double>(i);
+    }
+    CHECK(batch_split("x + y - 2i", {"x", "y"}, {xr, yr}, {xi, yi}));
+    CHECK(batch_split("x * y / (x - 3)", {"x", "y"}, {xr, yr}, {xi, yi}));
+    CHECK(batch_split("exp(x) + ln(y) * sin(x) - cos(y)", {"x", "y"}, {xr, yr}, {xi, yi}));
+    CHECK(batch_split("ln(x * i) / exp(i * y) + x ^ y", {"x", "y"}, {xr, yr}, {xi, yi}));
+    CHECK_THROWS(batch_split("x / (y - y)", {"x", "y"}, {xr, yr}, {xi, yi}));
+
+    std::vector<double> special_re{0.0, -0.0, -1.0, 1.0, INFINITY, NAN, 1e300};
+    std::vector<double> special_im{0.0, 0.0, 0.0, -0.0, 1.0, 0.0, 1e300};
+    for (Function func : {SIN, COS, LN, EXP}) {
+        std::vector<double> out_re(special_re.size()), out_im(special_re.size());
+        vector_complex_function(func, special_re.data(), special_im.data(), out_re.data(), out_im.data(), special_re.size());
+        for (size_t i = 0; i < special_re.size(); ++i) {
+            auto expected = apply_function(func, to_cm(special_re[i], special_im[i]));
+            bool same_re = out_re[i] == expected.real() || (std::isnan(out_re[i]) && std::isnan(expected.real()));
+            bool same_im = out_im[i] == expected.imag() || (std::isnan(out_im[i]) && std::isnan(expected.imag()));
+            bool close = std::abs(to_cm(out_re[i], out_im[i]) - expected) <= 1e-15 * std::abs(expected);
+            CHECK(((same_re && same_im) || close));
+        }
+    }
+}
+
+TEST_CASE("Параллельный подсчет") {
+    ThreadPool pool(4);
+    CHECK(pool.size() == 4);
+
+    std::vector<std::atomic<int>> hits(1000);
+    pool.parallel_for(hits.size(), [&](size_t i) { hits[i]++; });
+    bool once = true;
+    for (auto &hit : hits) once &= hit == 1;
+    CHECK(once);
+    CHECK_THROWS_WITH(pool.parallel_for(100, [](size_t i) {
+        if (i == 42) throw std::runtime_error("task failed");
+    }), "task failed");
+
+    const size_t rows = 5 * Program<double>::CHUNK + 123;
+    std::vector<double> x(rows), y(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        x[i] = std::sin(static_cast<double>(i)) * 3;
+        y[i] = 1.5 + std::cos(static_cast<double>(i));
+    }
+    auto program = compile(Parser<double>(tokenize("exp(x) * sin(y) + ln(y) / (x * x + 1) - y ^ 2")).parse());
+    program.bind({"x", "y"});
+    std::vector<std::span<const double>> columns{x, y};
+    std::vector<double> single(rows), parallel(rows);
+    program.eval_batch(columns, single);
+    program.eval_batch(columns, parallel, pool);
+    CHECK(std::memcmp(single.data(), parallel.data(), rows * sizeof(double)) == 0);
+
+    auto zero = compile(Parser<double>(tokenize("x / (y - y)")).parse());
+    zero.bind({"x", "y"});
+    CHECK_THROWS_WITH(zero.eval_batch(columns, parallel, pool), "Division by zero");
+
+    auto complex_program = compile(Parser<std::complex<double>>(tokenize("exp(i * x) * ln(y) + x / y")).parse());
+    complex_program.bind({"x", "y"});
+    std::vector<double> single_re(rows), single_im(rows), parallel_re(rows), parallel_im(rows);
+    std::vector<std::span<const double>> re{x, y}, im{y, x};
+    complex_program.eval_batch(re, im, single_re, single_im);
+    complex_program.eval_batch(re, im, parallel_re, parallel_im, pool);
+    CHECK(std::memcmp(single_re.data(), parallel_re.data(), rows * sizeof(double)) == 0);
+    CHECK(std::memcmp(single_im.data(), parallel_im.data(), rows * sizeof(double)) == 0);
+
+    ThreadPool inline_pool(1);
+    std::vector<double> inline_out(rows);
+    program.eval_batch(columns, inline_out, inline_pool);
+    CHECK(inline_out == single);
+}
+
+TEST_CASE("Общие узлы") {
+    auto first = Parser<double>(tokenize("sin(x) * (x + y) + sin(x)")).parse();
+    auto second = Parser<double>(tokenize("sin(x) * (x + y) + sin(x)")).parse();
+    CHECK(first == second);
+    auto sum = std::dynamic_pointer_cast<BinaryExpression<double>>(first);
+    REQUIRE(sum);
+    CHECK(sum->to_string() == "((sin(x) * (x + y)) + sin(x))");
+    CHECK(Parser<double>(tokenize("x")).parse() == make_var<double>("x"));
+    CHECK(make_constant(2.0) == make_constant(2.0));
+    CHECK(make_constant(0.0) != make_constant(-0.0));
+
+    // Повторное дифференцирование не создает новых узлов
+    std::string x = "x";
+    auto product = Parser<double>(tokenize("sin(x) * cos(x)")).parse();
+    auto derivative = product->diff(x);
+    CHECK(derivative == product->diff(x));
+
+    // Упрощение не портит общие узлы
+    auto shared = Parser<double>(tokenize("0 * x + x")).parse();
+    auto text = shared->to_string();
+    auto simple = optimize(shared);
+    CHECK(simple == make_var<double>("x"));
+    CHECK(shared->to_string() == text);
+    CHECK(optimize(Parser<double>(tokenize("0 - sin(x)")).parse())->to_string() == "((-1) * sin(x))");
+
+    ExpressionFactory<double>::current().purge();
+    size_t before = ExpressionFactory<double>::current().size();
+    {
+        auto temporary = Parser<double>(tokenize("exp(u) + ln(v * w)")).parse();
+        CHECK(ExpressionFactory<double>::current().size() > before);
+    }
+    ExpressionFactory<double>::current().purge();
+    CHECK(ExpressionFactory<double>::current().size() == before);
+}
+
+size_t tree_size(const std::string &text) { // число узлов развернутого дерева по записи
+    return std::count(text.begin(), text.end(), '(') + 1;
+}
+
+TEST_CASE("Общие подвыражения") {
+    std::string x = "x";
+    auto expr = Parser<double>(tokenize("sin(x) * exp(x) / (x + 2)")).parse();
+    for (int i = 0; i < 6; ++i) expr = expr->diff(x);
+    auto program = compile(expr);
+    CHECK(program.temps > 0);
+    CHECK(program.code.size() * 20 < tree_size(expr->to_string()));
+
+    std::map<std::string, double> params{{"x", 0.7}};
+    double expected = expr->eval(params);
+    CHECK(std::abs(program.eval(params) - expected) <= 1e-12 * std::abs(expected));
+
+    std::vector<double> xs(3000), out(xs.size());
+    for (size_t i = 0; i < xs.size(); ++i) xs[i] = 0.001 * static_cast<double>(i);
+    std::vector<std::span<const double>> columns{xs};
+    program.eval_batch(columns, out);
+    bool same = true;
+    for (size_t i = 0; i < xs.size(); i += 97) {
+        std::map<std::string, double> row{{"x", xs[i]}};
+        double value = program.eval(row);
+        same &= std::abs(out[i] - value) <= 1e-12 * std::max(1.0, std::abs(value));
+    }
+    CHECK(same);
+
+    auto complex_expr = Parser<std::complex<double>>(tokenize("sin(x) * sin(x) + sin(x) / x")).parse();
+    auto complex_program = compile(complex_expr);
+    CHECK(complex_program.temps == 1);
+    std::vector<double> re{0.5, 1.5}, im{0.25, -1.0}, out_re(2), out_im(2);
+    std::vector<std::span<const double>> re_columns{re}, im_columns{im};
+    complex_program.eval_batch(re_columns, im_columns, out_re, out_im);
+    std::map<std::string, std::complex<double>> point{{"x", to_cm(1.5, -1.0)}};
+    auto value = complex_expr->eval(point);
+    CHECK(std::abs(std::complex<double>(out_re[1], out_im[1]) - value) <= 1e-15 * std::abs(value));
+}
+
+TEST_CASE("Кэш производных") {
+    std::string x = "x";
+    // Каждый уровень дважды ссылается на предыдущий: без кэша производная растет как 2^n
+    auto expr = make_var<double>("x");
+    for (int i = 0; i < 40; ++i) {
+        expr = make_binary(make_mono(expr, SIN), make_binary(expr, make_constant(2.0), DIV), MULT);
+    }
+    auto first = expr->diff(x);
+    auto second = first->diff(x);
+    CHECK(compile(first).code.size() < 2000);
+    CHECK(compile(second).code.size() < 20000);
+
+    // Кэш можно передать между вызовами по одной переменной
+    Expression<double>::DiffCache cache;
+    CHECK(expr->diff(x, cache) == first);
+    size_t cached = cache.size();
+    CHECK(expr->diff(x, cache) == first);
+    CHECK(cache.size() == cached);
+
+    // Узлы умирают между вызовами, но их адреса не достаются новым узлам, пока жив кэш
+    Expression<double>::DiffCache shared;
+    std::map<std::string, double> point{{"x", 0.7}};
+    bool fresh = true;
+    for (int i = 0; i < 200; ++i) {
+        auto temporary = make_binary(make_mono(make_binary(make_var<double>("x"), make_constant(double(i)), MULT), SIN),
+                                     make_constant(2.0), PLUS);
+        fresh &= temporary->diff(x, shared)->eval(point) == temporary->diff(x)->eval(point);
+    }
+    CHECK(fresh);
+
+    // Один кэш на несколько переменных: записи разных переменных не смешиваются
+    Expression<double>::DiffCache both;
+    std::string y = "y";
+    auto product = Parser<double>(tokenize("sin(x*y)+x")).parse();
+    CHECK(product->diff(x, both)->to_string() == product->diff(x)->to_string());
+    CHECK(product->diff(y, both)->to_string() == "((cos(x * y) * ((0 * y) + (x * 1))) + 0)");
+
+    std::map<std::string, double> params{{"x", 0.3}};
+    auto program = compile(first);
+    double h = 1e-6, x0 = params["x"];
+    auto at = [&](double value) {
+        std::map<std::string, double> point{{"x", value}};
+        return compile(expr).eval(point);
+    };
+    double numeric = (at(x0 + h) - at(x0 - h)) / (2 * h);
+    CHECK(std::abs(program.eval(params) - numeric) <= 1e-6 * std::max(1.0, std::abs(numeric)));
+}
+
+template <typename T>
+bool gradient_matches(const std::string &input, std::map<std::string, T> params) {
+    auto expr = Parser<T>(tokenize(input)).parse();
+    auto grad = gradient(expr, params);
+    bool same = grad.size() == params.size();
+    for (auto &[name, value] : params) {
+        std::string var = name;
+        T expected = expr->diff(var)->eval(params);
+        same &= std::abs(grad[name] - expected) <= 1e-12 * std::max(1.0, std::abs(expected));
+    }
+    return same;
+}
+
+TEST_CASE("Градиент") {
+    CHECK(gradient_matches<double>("x * y + sin(x) / y - exp(z) ^ 2 + ln(x * z)", {{"x", 0.7}, {"y", 1.3}, {"z", 0.4}}));
+    CHECK(gradient_matches<double>("x ^ 3 + 2 ^ x + (x + y) ^ 3 - cos(y) ^ 2", {{"x", 1.7}, {"y", 0.6}}));
+    CHECK(gradient_matches<double>("x / (y - x) * exp(sin(x * y))", {{"x", 0.2}, {"y", 1.1}}));
+    CHECK(gradient_matches<std::complex<double>>("x * y + exp(i * x) / y - ln(y)",
+                                                 {{"x", to_cm(0.5, 0.3)}, {"y", to_cm(-1.2, 0.7)}}));
+
+    // Общие узлы после diff и запись в виде слотов
+    std::string x = "x";
+    auto derivative = Parser<double>(tokenize("sin(x * y) * cos(x * y)")).parse()->diff(x);
+    std::map<std::string, double> point{{"x", 0.8}, {"y", -0.4}};
+    auto grad = gradient(derivative, point);
+    std::string y = "y";
+    CHECK(std::abs(grad["x"] - derivative->diff(x)->eval(point)) <= 1e-12);
+    CHECK(std::abs(grad["y"] - derivative->diff(y)->eval(point)) <= 1e-12);
+
+    // f ^ g: d/dx = g f^(g-1), d/dy = f^g ln f
+    std::map<std::string, double> base{{"x", 1.7}, {"y", 0.6}};
+    auto power = gradient(Parser<double>(tokenize("x ^ y")).parse(), base);
+    CHECK(std::abs(power["x"] - 0.6 * std::pow(1.7, -0.4)) <= 1e-15);
+    CHECK(std::abs(power["y"] - std::pow(1.7, 0.6) * std::log(1.7)) <= 1e-15);
+
+    auto program = compile(Parser<double>(tokenize("x * x * y")).parse());
+    program.bind({"y", "x"});
+    std::vector<double> values{3.0, 2.0}, slots(2);
+    CHECK(program.gradient(values, slots) == 12.0);
+    CHECK(slots == std::vector<double>{4.0, 12.0});
+    CHECK_THROWS_WITH(program.gradient(std::span<const double>(values.data(), 1), slots), "Expected 2 values");
+    CHECK_THROWS_WITH(gradient(Parser<double>(tokenize("1 / (x - x)")).parse(), point), "Division by zero");
+}
+
+template <typename T>
+bool dual_matches(const std::string &input, std::map<std::string, T> params, std::string var) {
+    auto expr = Parser<T>(tokenize(input)).parse();
+    T expected = expr->diff(var)->eval(params);
+    T actual = derivative(expr, params, var);
+    return std::abs(actual - expected) <= 1e-12 * std::max(1.0, std::abs(expected));
+}
+
+TEST_CASE("Дуальные числа") {
+    CHECK(dual_matches<double>("sin(x) * exp(x) / (x + 2)", {{"x", 0.7}}, "x"));
+    CHECK(dual_matches<double>("ln(x * y) - cos(y) ^ 2 + x ^ 3", {{"x", 1.4}, {"y", -0.3}}, "y"));
+    CHECK(dual_matches<double>("2 ^ x + (x - 3) ^ 2", {{"x", 0.5}}, "x"));
+    CHECK(dual_matches<std::complex<double>>("exp(i * x) / (x + y) - ln(x) * y", {{"x", to_cm(0.4, 0.9)}, {"y", to_cm(2, -1)}}, "x"));
+
+    // Производная по направлению совпадает с градиентом
+    auto program = compile(Parser<double>(tokenize("x * y + sin(x) / y")).parse());
+    std::vector<Dual<double>> values{{0.8, 1.0}, {1.5, 2.0}};
+    auto result = program.eval(std::span<const Dual<double>>(values));
+    std::vector<double> point{0.8, 1.5}, grad(2);
+    CHECK(result.value == program.gradient(point, grad));
+    CHECK(std::abs(result.derivative - (grad[0] + 2 * grad[1])) <= 1e-15);
+
+    // Постоянная степень отрицательного основания
+    std::map<std::string, double> negative{{"x", -2.0}};
+    CHECK(derivative(Parser<double>(tokenize("x ^ 3")).parse(), negative, "x") == 12.0);
+    CHECK_THROWS_WITH(derivative(Parser<double>(tokenize("1 / (x - x)")).parse(), negative, "x"), "Division by zero");
+}
+
+template <typename T>
+bool taylor_matches(const std::string &input, std::map<std::string, T> params, std::string var, size_t order) {
+    auto expr = Parser<T>(tokenize(input)).parse();
+    auto values = derivatives(expr, params, var, order);
+    // Ряд производной - сдвинутый ряд самой функции; символьно берется только первая производная
+    auto shifted = derivatives(expr->diff(var), params, var, order - 1);
+    bool same = values.size() == order + 1 && shifted.size() == order;
+    for (size_t n = 0; n <= order; ++n) {
+        T expected = n == 0 ? expr->eval(params) : shifted[n - 1];
+        same &= std::abs(values[n] - expected) <= 1e-10 * std::max(1.0, std::abs(expected));
+    }
+    return same;
+}
+
+TEST_CASE("Ряды Тейлора") {
+    CHECK(taylor_matches<double>("sin(x) * exp(x) / (x + 2)", {{"x", 0.7}}, "x", 4));
+    CHECK(taylor_matches<double>("ln(x * y) - cos(y) ^ 2 + x ^ 3", {{"x", 1.4}, {"y", 0.3}}, "y", 4));
+    CHECK(taylor_matches<double>("2 ^ x + (x - 3) ^ 2 + cos(x) ^ 3 / (x + 1) ^ 2", {{"x", 0.5}}, "x", 3));
+    CHECK(taylor_matches<std::complex<double>>("exp(i * x) * sin(x * y) - cos(x) * y", {{"x", to_cm(0.4, 0.9)}, {"y", to_cm(2, -1)}}, "x", 3));
+
+    // Известные ряды: e^x в нуле, x^x и степень нулевого основания
+    std::map<std::string, double> zero{{"x", 0.0}};
+    auto exponent = derivatives(Parser<double>(tokenize("exp(2 * x)")).parse(), zero, "x", 10);
+    bool powers = true;
+    for (size_t n = 0; n <= 10; ++n) powers &= std::abs(exponent[n] - std::pow(2.0, n)) <= 1e-12 * std::pow(2.0, n);
+    CHECK(powers);
+    CHECK(derivatives(Parser<double>(tokenize("x ^ 3")).parse(), zero, "x", 4) == std::vector<double>{0, 0, 0, 6, 0});
+
+    std::map<std::string, double> one{{"x", 1.0}};
+    auto self = derivatives(Parser<double>(tokenize("x ^ x")).parse(), one, "x", 3);
+    CHECK(std::abs(self[1] - 1) <= 1e-14);
+    CHECK(std::abs(self[2] - 2) <= 1e-14);
+    CHECK(std::abs(self[3] - 3) <= 1e-14);
+    CHECK_THROWS_WITH(derivatives(Parser<double>(tokenize("1 / (x - x)")).parse(), one, "x", 2), "Division by zero");
+}
+
+TEST_CASE("Матрица Якоби") {
+    std::vector<std::shared_ptr<Expression<double>>> system;
+    for (auto text : {"x * y + sin(x * z)", "exp(x * z) - y / z", "sin(x * z) * y ^ 2", "ln(x + y + z)"}) {
+        system.push_back(Parser<double>(tokenize(text)).parse());
+    }
+    std::vector<std::string> names{"x", "y", "z"};
+    std::vector<double> point{0.4, 1.3, 0.9};
+    std::map<std::string, double> params{{"x", 0.4}, {"y", 1.3}, {"z", 0.9}};
+
+    std::vector<double> expected;
+    for (auto &expr : system) {
+        for (auto name : names) expected.push_back(expr->diff(name)->eval(params));
+    }
+    auto close = [&](const std::vector<double> &actual) {
+        bool same = actual.size() == expected.size();
+        for (size_t k = 0; same && k < actual.size(); ++k) {
+            same &= std::abs(actual[k] - expected[k]) <= 1e-12 * std::max(1.0, std::abs(expected[k]));
+        }
+        return same;
+    };
+    CHECK(close(jacobian(system, names, std::span<const double>(point))));
+    CHECK(close(jacobian(system, names, std::span<const double>(point), FORWARD_MODE)));
+    CHECK(close(jacobian(system, names, std::span<const double>(point), REVERSE_MODE)));
+
+    auto symbolic = jacobian_program(system, names);
+    CHECK(symbolic.outputs == 12);
+    std::vector<double> entries(12);
+    symbolic.eval(point, entries);
+    CHECK(close(entries));
+
+    // sin(x * z) встречается в двух выражениях, но считается один раз
+    auto program = compile(system);
+    CHECK(program.outputs == 4);
+    CHECK(program.temps > 0);
+    std::vector<double> values(4);
+    program.bind(names);
+    program.eval(point, values);
+    CHECK(values[2] == system[2]->eval(params));
+    CHECK(program.eval(std::span<const double>(point)) == values[0]);
+
+    std::vector<std::shared_ptr<Expression<std::complex<double>>>> complex_system{
+        Parser<std::complex<double>>(tokenize("x * y + exp(i * x)")).parse(),
+        Parser<std::complex<double>>(tokenize("sin(x) / y")).parse()};
+    std::vector<std::complex<double>> complex_point{to_cm(0.3, 0.2), to_cm(1.1, -0.5)};
+    auto complex_jacobian = jacobian(complex_system, {"x", "y"}, std::span<const std::complex<double>>(complex_point), REVERSE_MODE);
+    std::map<std::string, std::complex<double>> complex_params{{"x", complex_point[0]}, {"y", complex_point[1]}};
+    std::string y = "y";
+    CHECK(std::abs(complex_jacobian[3] - complex_system[1]->diff(y)->eval(complex_params)) <= 1e-14);
+}
+
+TEST_CASE("Арена узлов") {
+    std::string x = "x";
+    std::map<std::string, double> params{{"x", 0.6}, {"y", 1.7}};
+    auto heap = Parser<double>(tokenize("sin(x) * exp(x * y) / (x + y)")).parse();
+    auto expected = optimize(heap->diff(x))->to_string();
+    double value = optimize(heap->diff(x))->eval(params);
+
+    Program<double> program;
+    size_t before = ExpressionFactory<double>::current().size();
+    {
+        ExpressionArena<double> arena;
+        ExpressionArena<double>::Scope scope(arena);
+        auto expr = Parser<double>(tokenize("sin(x) * exp(x * y) / (x + y)")).parse();
+        CHECK(expr.use_count() == 0); // без счетчика ссылок
+        CHECK(expr != heap);
+        CHECK(expr == Parser<double>(tokenize("sin(x) * exp(x * y) / (x + y)")).parse());
+        auto derivative = optimize(expr->diff(x));
+        CHECK(derivative->to_string() == expected);
+        CHECK(arena.size() > 10);
+        program = compile(derivative);
+        {
+            ExpressionArena<double> inner;
+            ExpressionArena<double>::Scope inner_scope(inner);
+            make_var<double>("z");
+            CHECK(inner.size() == 1);
+        }
+        make_var<double>("z");
+        CHECK(arena.size() > 11);
+    }
+    CHECK(ExpressionFactory<double>::current().size() == before);
+    CHECK(program.eval(params) == value);
+    CHECK(make_var<double>("x").use_count() > 0);
+}
+
+template <typename T>
+bool flat_matches(const std::string &input, std::map<std::string, T> params) {
+    std::string x = "x";
+    auto expr = Parser<T>(tokenize(input)).parse();
+    FlatExpression<T> flat(expr);
+    auto derivative = optimize(expr->diff(x));
+    auto flat_derivative = flat.diff(x).optimize();
+    return flat.to_string() == expr->to_string() && flat.eval(params) == expr->eval(params) &&
+           flat_derivative.to_string() == derivative->to_string() &&
+           flat_derivative.to_expression() == derivative;
+}
+
+TEST_CASE("Плоское представление") {
+    std::map<std::string, double> point{{"x", 0.8}, {"y", 1.3}};
+    for (auto input : {"x", "3 * x + 5", "x^5 - 3 * x^3 + 2 * x", "x / (x^2 + 1)", "ln(x^2 + 1)", "x^x",
+                       "cos(ln(x))", "ln(x) / x^3", "sin(x) * cos(x) - 0 * y", "0 - exp(x * y)", "x ^ 0.5 + 2 ^ x",
+                       "sin(x) ^ 1 + (x * x) ^ 1"}) {
+        CHECK(flat_matches<double>(input, point));
+    }
+    std::map<std::string, std::complex<double>> complex_point{{"x", to_cm(0.3, 0.7)}};
+    for (auto input : {"(3+2i)*x + (1-4i)", "exp(i*x)*sin(x)", "(x-i)/(x+i)", "ln((3+4i)*x)", "cos(2i*x)"}) {
+        CHECK(flat_matches<std::complex<double>>(input, complex_point));
+    }
+
+    // Узлы общие и занимают 12 байт
+    FlatExpression<double> flat(Parser<double>(tokenize("sin(x * y) * sin(x * y) + x * y")).parse());
+    CHECK(sizeof(FlatNode) == 12);
+    CHECK(flat.nodes.size() == 6); // x, y, x * y, sin, *, +
+    CHECK(flat.names == std::vector<std::string>{"x", "y"});
+    std::vector<double> values{0.8, 1.3};
+    CHECK(flat.eval(std::span<const double>(values)) == flat.to_expression()->eval(point));
+
+    // Вторая производная остается компактной
+    auto second = flat.diff("x").diff("x");
+    std::string x = "x";
+    auto tree = flat.to_expression()->diff(x)->diff(x);
+    CHECK(std::abs(second.eval(point) - tree->eval(point)) <= 1e-12);
+    CHECK(second.to_string() == tree->to_string());
+    CHECK_THROWS_WITH(FlatExpression<double>(Parser<double>(tokenize("x / (2 - 2)")).parse()).eval(point), "Division by zero");
+    CHECK_THROWS_WITH(FlatExpression<double>(Parser<double>(tokenize("x + 1 / 0")).parse()).optimize(), "Division by zero");
+}
+
+TEST_CASE("Таблица имен") {
+    Symbol x = intern_symbol("x");
+    CHECK(intern_symbol("x") == x);
+    CHECK(find_symbol("x") == x);
+    CHECK(symbol_name(x) == "x");
+    CHECK(find_symbol("never_used_name") == NO_SYMBOL);
+    CHECK_THROWS_WITH(symbol_name(NO_SYMBOL), "Unknown symbol: " + std::to_string(NO_SYMBOL));
+    CHECK(sizeof(VarExpression<double>) < sizeof(std::string) + sizeof(void *));
+
+    // Неизвестная переменная: производная 0, таблица не растет
+    size_t before = symbol_count();
+    std::string unknown = "never_used_name";
+    CHECK(optimize(Parser<double>(tokenize("sin(x) * y")).parse()->diff(unknown))->to_string() == "0");
+    CHECK(symbol_count() == before);
+
+    // Одновременная регистрация из разных потоков дает одни и те же номера
+    ThreadPool pool(4);
+    std::vector<Symbol> symbols(400);
+    pool.parallel_for(symbols.size(), [&](size_t i) { symbols[i] = intern_symbol("v" + std::to_string(i % 40)); });
+    bool same = true;
+    for (size_t i = 0; i < symbols.size(); ++i) same &= symbols[i] == symbols[i % 40];
+    CHECK(same);
+    CHECK(symbol_name(symbols[7]) == "v7");
+}
+
+TEST_CASE("Токены без копирования") {
+    std::string input = "-SIN(Xy) * 2.5i + (-x)i";
+    auto tokens = tokenize(input);
+    REQUIRE(tokens.size() == 16);
+    CHECK(tokens[0].type == NUMBER); // вставленный 0 для унарного минуса
+    CHECK(tokens[0].value == "0");
+    CHECK(tokens[1].code == MINUS);
+    CHECK(tokens[2].type == FUNCTION);
+    CHECK(tokens[2].code == SIN);
+    CHECK(tokens[2].value.data() == input.data() + 1); // ссылается на входную строку
+    CHECK(tokens[4].type == VARIABLE);
+    CHECK(tokens[4].value == "Xy");
+    CHECK(tokens[6].code == MULT);
+    CHECK(tokens[7].type == COMPLEX);
+    CHECK(tokens[7].value == "2.5");
+    CHECK(tokens[10].type == NUMBER);
+    CHECK(tokens[14].type == OPERATOR); // ")i" -> ") * i"
+    CHECK(tokens[14].code == MULT);
+    CHECK(tokens[15].type == COMPLEX);
+    CHECK(scan_complex(input, "((0 - (sin(xy) * 2.500000i)) + ((0 - x) * 1i))"));
+    CHECK_THROWS_WITH(tokenize("x # y"), "Unknown character: #");
+}
+
+TEST_CASE("Разбор без вектора токенов") {
+    for (std::string input : {"x", "-SIN(Xy) * 2.5i + (-x)i", "a / b ^ c", "exp(a) - b * c / d", "x ^ y ^ z",
+                              "(1.2 + sin(3.4)) * i", "2 i + 3", "  sin(  x  )  "}) {
+        CHECK(Parser<std::complex<double>>(input).parse() == Parser<std::complex<double>>(tokenize(input)).parse());
+    }
+    CHECK_THROWS_WITH(Parser<double>(std::string_view("(x + y")).parse(), "Expected ')'");
+    CHECK_THROWS_WITH(Parser<double>(std::string_view("x + y)")).parse(), "Extra ')'");
+    CHECK_THROWS_WITH(Parser<double>(std::string_view("x +")).parse(), "Unexpected end of input in parsePrimary");
+    CHECK_THROWS_WITH(Parser<double>(std::string_view("x + $")).parse(), "Unknown character: $");
+
+    // Длинная сумма разбирается прямо из строки
+    std::string input = "x";
+    for (int i = 0; i < 4000; ++i) input += i % 2 ? " + x * y" : " - sin(y)";
+    auto expr = Parser<double>(input).parse();
+    std::map<std::string, double> params{{"x", 0.5}, {"y", 2.0}};
+    CHECK(std::abs(compile(expr).eval(params) - (0.5 + 2000 * (1.0 - std::sin(2.0)))) <= 1e-9);
+}
+
+TEST_CASE("Разбор без рекурсии") {
+    CHECK(scan_double("sin x ^ 2", "(sin(x)^2)"));
+    CHECK(scan_double("2 * sin(x) ^ 3 - 1", "((2 * (sin(x)^3)) - 1)"));
+    CHECK(scan_double("a - b - c + d", "(((a - b) - c) + d)"));
+    CHECK(scan_double("a / b * c ^ d ^ e", "((a / b) * ((c^d)^e))"));
+    CHECK(scan_double("ln exp(x * (y - 1))", "ln(exp(x * (y - 1)))"));
+    CHECK_THROWS_WITH(Parser<double>(tokenize("x y")).parse(), "Expected operation");
+    CHECK_THROWS_WITH(Parser<double>(tokenize("x + )")).parse(), "Unexpected token: )");
+    CHECK_THROWS_WITH(Parser<double>(tokenize("()")).parse(), "Unexpected token: )");
+    CHECK_THROWS_WITH(Parser<double>(tokenize("(x))")).parse(), "Extra ')'");
+    CHECK_THROWS_WITH(Parser<double>(tokenize("((x)")).parse(), "Expected ')'");
+    CHECK_THROWS_WITH(Parser<double>(tokenize("sin")).parse(), "Unexpected end of input in parsePrimary");
+
+    // Глубина вложенности ограничена только памятью
+    const int depth = 200000;
+    std::string parens = std::string(depth, '(') + "x" + std::string(depth, ')');
+    CHECK(Parser<double>(parens).parse() == make_var<double>("x"));
+
+    ExpressionArena<double> arena; // узлы арены удаляются без рекурсии
+    ExpressionArena<double>::Scope scope(arena);
+    std::string chain = "x";
+    for (int i = 0; i < depth; ++i) chain += "^x";
+    std::string functions;
+    for (int i = 0; i < depth; ++i) functions += "sin(";
+    functions += "x" + std::string(depth, ')');
+    CHECK(Parser<double>(chain).parse() != nullptr);
+    CHECK(Parser<double>(functions).parse() != nullptr);
+    CHECK(arena.size() == 2 * depth + 1);
+}
+
+TEST_CASE("Глубокие деревья") {
+    const int depth = 1000000;
+    auto x = make_var<double>("x");
+    std::string text = "x";
+    auto sum = x;
+    for (int i = 0; i < depth; ++i) {
+        sum = make_binary(sum, x, PLUS);
+        text += "+x";
+    }
+    CHECK(Parser<double>(text).parse() == sum);
+
+    std::map<std::string, double> point = {{"x", 0.5}};
+    CHECK(sum->eval(point) == Approx(0.5 * (depth + 1)));
+    CHECK(sum->to_string().size() == 6 * size_t(depth) + 1); // "(" + ... + " + x)"
+    CHECK(compile(sum).eval(point) == Approx(0.5 * (depth + 1)));
+    CHECK(FlatExpression<double>(sum).eval(point) == Approx(0.5 * (depth + 1)));
+
+    std::string name = "x";
+    auto derivative = optimize(sum->diff(name));
+    CHECK(derivative->eval(point) == Approx(depth + 1));
+
+    auto nested = x;
+    for (int i = 0; i < depth; ++i) nested = make_mono(nested, i % 2 ? SIN : COS);
+    CHECK(nested->to_string().size() == 5 * size_t(depth) + 1); // "sin(" + ... + ")"
+    CHECK(optimize(nested) == nested);
+    CHECK(std::isfinite(nested->eval(point)));
+
+    // Выражение в статическом объекте уничтожается уже после thread_local-переменных потока
+    static auto kept = make_binary(make_mono(make_binary(x, x, MULT), SIN), make_constant(2.0), POW);
+    CHECK(kept->eval(point) == Approx(std::pow(std::sin(0.25), 2)));
+
+    // Освобождение тоже без рекурсии
+    sum.reset();
+    derivative.reset();
+    nested.reset();
+    CHECK(x->eval(point) == 0.5);
+}
+
+TEST_CASE("Числа через from_chars") {
+    CHECK(parse_number("2.5e-3") == 2.5e-3);
+    CHECK(parse_number(".5") == 0.5);
+    CHECK(parse_number("5.") == 5.0);
+    CHECK(parse_number("0.1") == 0.1); // ближайший double, как у литерала
+    CHECK(parse_number("1.7976931348623157E308") == 1.7976931348623157e308);
+    CHECK_FALSE(parse_number("1.2.3"));
+    CHECK_FALSE(parse_number("."));
+    CHECK_FALSE(parse_number("1e999"));
+
+    auto tokens = tokenize("1e3 + 2E-2*e - 3e+x");
+    std::vector<std::string> values;
+    for (const auto &token : tokens) values.emplace_back(token.value);
+    CHECK(values == std::vector<std::string>{"1e3", "+", "2E-2", "*", "e", "-", "3", "e", "+", "x"});
+
+    std::map<std::string, double> point = {{"e", 2.0}};
+    CHECK(Parser<double>("1e3 + 2E-2 * e").parse()->eval(point) == Approx(1000.04));
+    CHECK(Parser<std::complex<double>>("1.5e1i").parse()->to_string() == "15i");
+    CHECK_THROWS_WITH(Parser<double>("1.2.3 + x").parse(), "Malformed number: 1.2.3");
+    CHECK_THROWS_WITH(Parser<double>("x * 1e999").parse(), "Malformed number: 1e999");
+}
+
+TEST_CASE("Классы символов") {
+    // Все байты в разных сочетаниях и на разных сдвигах относительно 16/32 байт
+    std::string text;
+    for (int i = 0; i < 4096; ++i) text += static_cast<char>((i * 7919 + i / 256) % 256);
+    std::string runs = "  \t\r\n\v\f   123456789012345678901234567890.5e10 abcdefghijklmnopqrstuvwxyzABCDEFGHIJ+";
+    const auto &scalar = kernel_table(SCALAR_KERNELS);
+    for (int level = SSE2_KERNELS; level <= supported_kernel_set(); ++level) {
+        const auto &table = kernel_table(static_cast<KernelSet>(level));
+        for (CharClass cls : {SPACE_CHARS, DIGIT_CHARS, NUMBER_CHARS, ALPHA_CHARS}) {
+            for (const std::string &s : {text, runs + runs + runs}) {
+                bool same = true;
+                for (size_t i = 0; i < s.size(); ++i) {
+                    same &= table.span(cls, s.data() + i, s.size() - i) == scalar.span(cls, s.data() + i, s.size() - i);
+                }
+                CHECK(same);
+            }
+        }
+    }
+    CHECK(scalar.span(SPACE_CHARS, runs.data(), runs.size()) == 10);
+    CHECK(scalar.span(NUMBER_CHARS, runs.data() + 10, runs.size() - 10) == 32);
+    CHECK(char_span(ALPHA_CHARS, "\xe9t\xe9", 3) == 0); // только ASCII, локаль не важна
+    CHECK(to_lower("SiN\xc9x") == "sin\xc9x");
+
+    std::string long_input;
+    for (int i = 0; i < 1000; ++i) long_input += "   sin(" + std::string(i % 50 + 1, 'v') + ")\t+ 123456.75e-3 * COS\n(x)";
+    auto tokens = tokenize(long_input);
+    CHECK(tokens.size() == 11000);
+    CHECK(tokens[11 * 49 + 2].value == std::string(50, 'v'));
+    CHECK(tokens[11 * 49 + 5].value == "123456.75e-3");
+}
+
+TEST_CASE("Кэш разбора") {
+    ExpressionCache<double> cache(3);
+    auto first = cache.get("Sin(X) * x + 2.5e1", {"x"});
+    CHECK(cache.misses() == 1);
+    CHECK(cache.get("sin(x)*X+2.5e1", {"X"}) == first); // та же нормализованная строка
+    CHECK(cache.hits() == 1);
+    CHECK(cache.get("sin(x) * x + 2.5e1") != first); // другие переменные - другая запись
+
+    CHECK(first->expr->to_string() == "((sin(x) * x) + 25)");
+    CHECK(first->variables == std::vector<std::string>{"x"});
+    REQUIRE(first->derivatives.size() == 1);
+    std::vector<double> values = {0.5}, out(2);
+    first->program.eval(std::span<const double>(values), std::span<double>(out));
+    CHECK(out[0] == Approx(std::sin(0.5) * 0.5 + 25));
+    CHECK(out[1] == Approx(std::cos(0.5) * 0.5 + std::sin(0.5)));
+
+    // Вытесняется давно не использованная запись
+    cache.get("x + 1");
+    CHECK(cache.size() == 3);
+    cache.get("x + 2");
+    CHECK(cache.size() == 3);
+    size_t misses = cache.misses();
+    cache.get("x+2");
+    cache.get("x + 1");
+    CHECK(cache.misses() == misses);
+    cache.get("sin(x) * x + 2.5e1", {"x"}); // вытеснена
+    CHECK(cache.misses() == misses + 1);
+    CHECK(first->program.eval(std::span<const double>(values)) == Approx(std::sin(0.5) * 0.5 + 25)); // запись жива
+
+    CHECK_THROWS_WITH(cache.get("x + "), "Unexpected end of input in parsePrimary");
+    CHECK_THROWS_WITH(cache.get("x + "), "Unexpected end of input in parsePrimary");
+    CHECK(cache.size() == 3);
+    CHECK_THROWS(ExpressionCache<double>(0));
+
+    // Запись, созданная внутри области арены, живет в куче и переживает арену
+    std::shared_ptr<const CompiledExpression<double>> scoped;
+    {
+        ExpressionArena<double> arena;
+        ExpressionArena<double>::Scope scope(arena);
+        scoped = cache.get("exp(x) * x - 7", {"x"});
+        CHECK(arena.size() == 0);
+        CHECK(make_var<double>("w") != nullptr); // сама область по-прежнему пишет в арену
+        CHECK(arena.size() == 1);
+    }
+    CHECK(cache.get("exp(x) * x - 7", {"x"}) == scoped);
+    std::map<std::string, double> at_one{{"x", 1.0}};
+    CHECK(scoped->expr->eval(at_one) == Approx(std::exp(1.0) - 7));
+    CHECK(scoped->derivatives[0]->to_string() == "((exp(x) * x) + exp(x))");
+
+    // Одновременный доступ: каждая строка разбирается не больше раза на поток
+    ExpressionCache<double> shared(64);
+    ThreadPool pool(4);
+    std::vector<double> results(4000);
+    pool.parallel_for(results.size(), [&](size_t i) {
+        auto entry = shared.get("x * " + std::to_string(i % 16) + " + y", {"y"});
+        std::map<std::string, double> point = {{"x", 2}, {"y", 1}};
+        results[i] = entry->program.eval(point);
+    });
+    for (size_t i = 0; i < results.size(); ++i) CHECK(results[i] == 2.0 * double(i % 16) + 1);
+    CHECK(shared.hits() + shared.misses() == results.size());
+    CHECK(shared.misses() >= 16);
+    CHECK(shared.misses() <= 16 * pool.size());
+    CHECK(shared.size() == 16);
+
+    // Мнимая единица и комплексные литералы не совпадают с действительными числами
+    ExpressionCache<std::complex<double>> complex_cache;
+    std::map<std::string, std::complex<double>> point = {{"x", to_cm(2, 0)}};
+    auto value = [&](std::string_view text) { return complex_cache.get(text)->program.eval(point); };
+    CHECK(value("x * 1") == to_cm(2, 0));
+    CHECK(value("x * i") == to_cm(0, 2));
+    CHECK(value("x + 2") == to_cm(4, 0));
+    CHECK(value("x + 2i") == to_cm(2, 2));
+    CHECK(value("(x) * 1") == to_cm(2, 0));
+    CHECK(value("(x)i") == to_cm(0, 2));
+    CHECK(complex_cache.misses() == 6);
+    CHECK(value("x*2i+x") == to_cm(2, 4));
+    CHECK(value("x * 2i + x") == to_cm(2, 4));
+    CHECK(complex_cache.hits() == 1);
+}
+
+TEST_CASE("Разбор файла по строкам") {
+    std::string text;
+    std::vector<size_t> bad;
+    for (size_t line = 1; line <= 20000; ++line) {
+        if (line % 997 == 0) {
+            text += "x + (y * 2\n";
+            bad.push_back(line);
+        } else if (line % 101 == 0) {
+            text += "   \r\n";
+        } else {
+            text += "sin(x) * " + std::to_string(line) + " + y\r\n";
+        }
+    }
+    text += "x ^ 2"; // последняя строка без перевода строки
+
+    std::map<std::string, double> point = {{"x", 0.5}, {"y", 2}};
+    for (size_t threads : {1, 4}) {
+        ThreadPool pool(threads);
+        auto parsed = parse_lines<double>(text, pool);
+        REQUIRE(parsed.expressions.size() == 20001);
+        REQUIRE(parsed.errors.size() == bad.size());
+        for (size_t i = 0; i < bad.size(); ++i) {
+            CHECK(parsed.errors[i].line == bad[i]);
+            CHECK(parsed.errors[i].message == "Expected ')'");
+        }
+        bool same = true;
+        for (size_t line = 1; line <= 20000; ++line) {
+            auto &expr = parsed.expressions[line - 1];
+            if (line % 997 == 0 || line % 101 == 0) same &= expr == nullptr;
+            else same &= expr && expr->eval(point) == std::sin(0.5) * double(line) + 2;
+        }
+        CHECK(same);
+        CHECK(parsed.expressions.back()->to_string() == "(x^2)");
+    }
+
+    ThreadPool pool(2);
+    CHECK(parse_lines<double>("", pool).expressions.empty());
+    CHECK(parse_lines<double>("x\n", pool).expressions.size() == 1);
+    CHECK_THROWS_WITH(parse_file<double>("/nonexistent/formulas.txt", pool), "Cannot open file: /nonexistent/formulas.txt");
+
+    std::string path = "expression_file_test.txt";
+    {
+        std::ofstream out(path);
+        out << "x * y\n\n1 / \nexp(x)\n";
+    }
+    auto parsed = parse_file<double>(path, pool);
+    std::remove(path.c_str());
+    REQUIRE(parsed.expressions.size() == 4);
+    CHECK(parsed.expressions[0]->to_string() == "(x * y)");
+    CHECK(parsed.expressions[1] == nullptr);
+    REQUIRE(parsed.errors.size() == 1);
+    CHECK(parsed.errors[0].line == 3);
+    CHECK(parsed.expressions[3]->to_string() == "exp(x)");
+}